@@ -0,0 +1,323 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <filesystem>
+
+#include <zlib.h>
+
+#include "Image.h"
+#include "Inflate.h"
+#include "Encoder.h"
+#include "Checksum.h"
+
+// Decodes every PNG in the corpus with each inflate backend and reports throughput, and what verifying every checksum costs
+// with --encode it compresses every PNG and BMP at each effort preset instead and reports throughput and ratio
+// with --probe it only reads the headers of every PNG and BMP and reports files per second
+// usage: Benchmark [--runs N] [--encode | --probe] <file or directory>...
+
+struct Result {
+	double _seconds = 0.0;
+	uLong _checksum = 0;
+	bool _ok = false;
+};
+
+static std::vector<std::string> collect_images(int argc, char** argv, int first, bool bitmaps) {
+	std::vector<std::string> files;
+
+	for (int i = first; i < argc; ++i) {
+		const std::filesystem::path path(argv[i]);
+
+		if(std::filesystem::is_directory(path)) {
+			for (auto& entry : std::filesystem::recursive_directory_iterator(path)) {
+				const auto extension = entry.path().extension();
+
+				if(entry.is_regular_file() && (extension == ".png" || (bitmaps && extension == ".bmp"))) {
+					files.push_back(entry.path().string());
+				}
+			}
+		}
+		else {
+			files.push_back(path.string());
+		}
+	}
+
+	return files;
+}
+
+// Best of runs, the crc of the rows makes sure every backend produced the same pixels
+static Result time_decode(PNG& png, InflateBackend backend, int runs) {
+	set_inflate_backend(backend);
+
+	Result result;
+	result._seconds = 1e30;
+
+	for (int run = 0; run < runs; ++run) {
+		const size_t bytes_per_row = png.bytes_per_row();
+		uLong checksum = crc32(0, Z_NULL, 0);
+
+		const auto start = std::chrono::steady_clock::now();
+
+		result._ok = png.decode([&](int row, const char* pixels) {
+			checksum = crc32(checksum, (const Bytef*)pixels, uInt(bytes_per_row));
+		});
+
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		result._seconds = std::min(result._seconds, elapsed.count());
+		result._checksum = checksum;
+
+		if(!result._ok) {
+			break;
+		}
+	}
+
+	return result;
+}
+
+// Reading and decoding with the given checksum policy, best of runs
+static double time_read(const std::string& file, ChecksumPolicy policy, int runs) {
+	const ChecksumPolicy previous = checksum_policy();
+	set_checksum_policy(policy);
+
+	double best = 1e30;
+
+	for (int run = 0; run < runs; ++run) {
+		const auto start = std::chrono::steady_clock::now();
+
+		ImageReader reader(file);
+		if(PNG* png = dynamic_cast<PNG*>(reader.image())) {
+			png->decode([](int row, const char* pixels) {});
+		}
+
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::min(best, elapsed.count());
+	}
+
+	set_checksum_policy(previous);
+
+	return best;
+}
+
+// Best of runs for one preset, the size is the whole zlib stream
+static Result time_encode(const std::vector<char>& pixels, const PNG& png, int effort, int runs, size_t& compressed) {
+	const EncodeOptions options = effort_options(effort);
+
+	Result result;
+	result._seconds = 1e30;
+
+	std::vector<char> stream;
+
+	for (int run = 0; run < runs; ++run) {
+		const auto start = std::chrono::steady_clock::now();
+
+		result._ok = compress_scanlines(pixels.data(), png.bytes_per_row(), png.bytes_per_pixel(), png._ihdr_chunk._height, options, stream);
+
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		result._seconds = std::min(result._seconds, elapsed.count());
+
+		if(!result._ok) {
+			break;
+		}
+	}
+
+	compressed = stream.size();
+
+	return result;
+}
+
+static int benchmark_encode(const std::vector<std::string>& files, int runs) {
+	constexpr int effort_count = MAX_EFFORT - MIN_EFFORT + 1;
+
+	double total_seconds[effort_count] = { 0.0 };
+	double total_compressed[effort_count] = { 0.0 };
+	double total_bytes = 0.0;
+
+	std::cout << std::left << std::setw(40) << "file" << std::right << std::setw(8) << "effort" << std::setw(12) << "MB" << std::setw(12) << "MB/s" << std::setw(10) << "ratio" << '\n';
+	std::cout << std::fixed;
+
+	for (auto& file : files) {
+		ImageReader reader(file);
+
+		if(!reader.image()) {
+			std::cout << file << ": not an image, skipped" << '\n';
+			continue;
+		}
+
+		PNG png = reader.image()->to_png();
+		const std::vector<char> pixels = png._pixels.empty() ? png.raw_pixels() : std::move(png._pixels);
+
+		if(pixels.empty()) {
+			std::cout << file << ": can't be encoded, skipped" << '\n';
+			continue;
+		}
+
+		const double bytes = double(pixels.size());
+		const std::string name = std::filesystem::path(file).filename().string();
+
+		for (int effort = MIN_EFFORT; effort <= MAX_EFFORT; ++effort) {
+			size_t compressed = 0;
+			const Result result = time_encode(pixels, png, effort, runs, compressed);
+
+			std::cout << std::left << std::setw(40) << name << std::right << std::setw(8) << effort << std::setprecision(1) << std::setw(12) << bytes / 1e6;
+
+			if(!result._ok) {
+				std::cout << "  failed" << '\n';
+				continue;
+			}
+
+			std::cout << std::setw(12) << bytes / 1e6 / result._seconds << std::setprecision(3) << std::setw(10) << bytes / compressed << '\n';
+
+			total_seconds[effort - MIN_EFFORT] += result._seconds;
+			total_compressed[effort - MIN_EFFORT] += double(compressed);
+		}
+
+		total_bytes += bytes;
+	}
+
+	if(total_bytes > 0) {
+		for (int effort = MIN_EFFORT; effort <= MAX_EFFORT; ++effort) {
+			std::cout << std::left << std::setw(40) << "total" << std::right << std::setw(8) << effort << std::setprecision(1) << std::setw(12) << total_bytes / 1e6;
+			std::cout << std::setw(12) << total_bytes / 1e6 / total_seconds[effort - MIN_EFFORT];
+			std::cout << std::setprecision(3) << std::setw(10) << total_bytes / total_compressed[effort - MIN_EFFORT] << '\n';
+		}
+	}
+
+	return 0;
+}
+
+static int benchmark_probe(const std::vector<std::string>& files, int runs) {
+	double best = 1e30;
+	size_t probed = 0;
+
+	for (int run = 0; run < runs; ++run) {
+		probed = 0;
+
+		const auto start = std::chrono::steady_clock::now();
+
+		for (auto& file : files) {
+			ImageInfo info;
+			probed += probe_image(file, info);
+		}
+
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::min(best, elapsed.count());
+	}
+
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << files.size() << " files, " << probed << " probed, " << files.size() / best << " files/s" << '\n';
+
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	int runs = 5;
+	int first = 1;
+	bool encode = false;
+	bool probe = false;
+
+	for (; first < argc; ++first) {
+		if(strcmp(argv[first], "--runs") == 0 && first + 1 < argc) {
+			runs = std::max(1, atoi(argv[++first]));
+		}
+		else if(strcmp(argv[first], "--encode") == 0) {
+			encode = true;
+		}
+		else if(strcmp(argv[first], "--probe") == 0) {
+			probe = true;
+		}
+		else {
+			break;
+		}
+	}
+
+	const std::vector<std::string> files = collect_images(argc, argv, first, encode || probe);
+
+	if(files.empty()) {
+		std::cout << "usage: Benchmark [--runs N] [--encode | --probe] <file or directory>..." << '\n';
+		return 1;
+	}
+
+	if(probe) {
+		return benchmark_probe(files, runs);
+	}
+
+	if(encode) {
+		return benchmark_encode(files, runs);
+	}
+
+	const InflateBackend backends[] = { InflateBackend::Zlib, InflateBackend::Fast };
+	constexpr int backend_count = sizeof(backends) / sizeof(backends[0]);
+
+	double total_seconds[backend_count] = { 0.0 };
+	double total_bytes = 0.0;
+	double total_unchecked = 0.0;
+	double total_checked = 0.0;
+
+	std::cout << std::left << std::setw(40) << "file" << std::right << std::setw(12) << "MB";
+	for (auto backend : backends) {
+		std::cout << std::setw(12) << (std::string(inflate_backend_name(backend)) + " MB/s");
+	}
+	std::cout << std::setw(10) << "speedup" << std::setw(10) << "checks" << '\n';
+
+	std::cout << std::fixed << std::setprecision(1);
+
+	for (auto& file : files) {
+		ImageReader reader(file);
+
+		PNG* png = dynamic_cast<PNG*>(reader.image());
+		if(!png) {
+			std::cout << file << ": not a PNG, skipped" << '\n';
+			continue;
+		}
+
+		const double bytes = double(png->bytes_per_row() + 1) * png->_ihdr_chunk._height;
+
+		Result results[backend_count];
+		for (int i = 0; i < backend_count; ++i) {
+			results[i] = time_decode(*png, backends[i], runs);
+		}
+
+		std::cout << std::left << std::setw(40) << std::filesystem::path(file).filename().string() << std::right << std::setw(12) << bytes / 1e6;
+
+		bool ok = true;
+		for (int i = 0; i < backend_count; ++i) {
+			ok = ok && results[i]._ok && results[i]._checksum == results[0]._checksum;
+			std::cout << std::setw(12) << bytes / 1e6 / results[i]._seconds;
+		}
+
+		if(!ok) {
+			std::cout << "  backends disagree or failed" << '\n';
+			continue;
+		}
+
+		// every chunk crc and the adler32 against none at all, with the default backend
+		const double unchecked = time_read(file, ChecksumPolicy::Off, runs);
+		const double checked = time_read(file, ChecksumPolicy::All, runs);
+
+		std::cout << std::setw(9) << results[0]._seconds / results[backend_count - 1]._seconds << 'x';
+		std::cout << std::setw(9) << (checked / unchecked - 1.0) * 100.0 << '%' << '\n';
+
+		total_bytes += bytes;
+		total_unchecked += unchecked;
+		total_checked += checked;
+		for (int i = 0; i < backend_count; ++i) {
+			total_seconds[i] += results[i]._seconds;
+		}
+	}
+
+	if(total_bytes > 0) {
+		std::cout << std::left << std::setw(40) << "total" << std::right << std::setw(12) << total_bytes / 1e6;
+		for (int i = 0; i < backend_count; ++i) {
+			std::cout << std::setw(12) << total_bytes / 1e6 / total_seconds[i];
+		}
+		std::cout << std::setw(9) << total_seconds[0] / total_seconds[backend_count - 1] << 'x';
+		std::cout << std::setw(9) << (total_checked / total_unchecked - 1.0) * 100.0 << '%' << '\n';
+	}
+
+	return 0;
+}
@@ -0,0 +1,271 @@
+#include "Batch.h"
+#include "Image.h"
+#include "Decoder.h"
+#include "ThreadPool.h"
+
+#include <set>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static std::string lower_extension(const fs::path& path) {
+	std::string ext = path.extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+	return ext;
+}
+
+static bool is_image_file(const fs::path& path) {
+	const std::string ext = lower_extension(path);
+	return ext == ".png" || ext == ".bmp";
+}
+
+// * matches any run of characters and ? any single one
+static bool wildcard_match(const char* pattern, const char* name) {
+	const char* star = nullptr;
+	const char* resume = nullptr;
+
+	while(*name) {
+		if(*pattern == '?' || (*pattern != '*' && *pattern == *name)) {
+			++pattern;
+			++name;
+		}
+		else if(*pattern == '*') {
+			star = pattern++;
+			resume = name;
+		}
+		else if(star) {
+			pattern = star + 1;
+			name = ++resume;
+		}
+		else {
+			return false;
+		}
+	}
+
+	while(*pattern == '*') {
+		++pattern;
+	}
+
+	return *pattern == 0;
+}
+
+// ****************************************************************************************************
+
+struct BatchInput {
+	fs::path _file;
+	fs::path _relative;  // where it goes below the output directory
+};
+
+static bool expand_input(const std::string& input, std::vector<BatchInput>& files);
+
+static bool expand_list(const std::string& list, std::vector<BatchInput>& files) {
+	std::ifstream stream(list);
+	if(!stream) {
+		std::cout << "Unable to read list -- " << list << '\n';
+		return false;
+	}
+
+	bool ok = true;
+	for (std::string line; std::getline(stream, line);) {
+		while(!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+			line.pop_back();
+		}
+
+		if(!line.empty()) {
+			ok &= expand_input(line, files);
+		}
+	}
+
+	return ok;
+}
+
+static bool expand_input(const std::string& input, std::vector<BatchInput>& files) {
+	if(input.size() > 1 && input[0] == '@') {
+		return expand_list(input.substr(1), files);
+	}
+
+	std::error_code error;
+	const fs::path path(input);
+
+	if(input.find_first_of("*?") != std::string::npos) {
+		const fs::path directory = path.has_parent_path() ? path.parent_path() : fs::path(".");
+		const std::string pattern = path.filename().string();
+
+		if(directory.string().find_first_of("*?") != std::string::npos) {
+			std::cout << "Wildcards are only supported in the file name -- " << input << '\n';
+			return false;
+		}
+
+		for (fs::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+			if(it->is_regular_file(error) && wildcard_match(pattern.c_str(), it->path().filename().string().c_str())) {
+				files.push_back({ it->path(), it->path().filename() });
+			}
+		}
+
+		if(error) {
+			std::cout << "Unable to list directory -- " << directory.string() << '\n';
+			return false;
+		}
+
+		return true;
+	}
+
+	if(fs::is_directory(path, error)) {
+		for (fs::recursive_directory_iterator it(path, error), end; !error && it != end; it.increment(error)) {
+			if(it->is_regular_file(error) && is_image_file(it->path())) {
+				files.push_back({ it->path(), it->path().lexically_relative(path) });
+			}
+		}
+
+		if(error) {
+			std::cout << "Unable to list directory -- " << input << '\n';
+			return false;
+		}
+
+		return true;
+	}
+
+	if(!fs::is_regular_file(path, error)) {
+		std::cout << "No such file -- " << input << '\n';
+		return false;
+	}
+
+	files.push_back({ path, path.filename() });
+	return true;
+}
+
+bool collect_batch_jobs(const std::vector<std::string>& inputs, const std::string& out, std::vector<BatchJob>& jobs) {
+	std::vector<BatchInput> files;
+
+	bool ok = true;
+	for (const auto& input : inputs) {
+		ok &= expand_input(input, files);
+	}
+
+	std::set<fs::path> sources;
+	for (const auto& file : files) {
+		sources.insert(file._file.lexically_normal());
+	}
+
+	std::set<fs::path> outputs;
+	std::set<fs::path> seen;
+	for (const auto& file : files) {
+		const fs::path source = file._file.lexically_normal();
+		if(!seen.insert(source).second) { // named twice, e.g. by a directory and a glob
+			continue;
+		}
+
+		const bool is_bmp = lower_extension(source) == ".bmp";
+
+		fs::path output = out.empty() ? source : fs::path(out) / file._relative;
+		output.replace_extension(is_bmp ? ".png" : ".bmp");
+		output = output.lexically_normal();
+
+		if(sources.count(output) || !outputs.insert(output).second) {
+			std::cout << "Skipping " << source.string() << ", " << output.string() << " would be overwritten" << '\n';
+			continue;
+		}
+
+		std::error_code error;
+		const uint64_t size = fs::file_size(source, error);
+
+		output.replace_extension();
+		jobs.push_back({ source.string(), output.string(), error ? 0 : size });
+	}
+
+	// the biggest files go first so a large one picked up last doesn't leave the other threads idle at the end
+	std::stable_sort(jobs.begin(), jobs.end(), [](const BatchJob& a, const BatchJob& b) { return a._size > b._size; });
+
+	return ok;
+}
+
+// ****************************************************************************************************
+
+static bool convert_file(const BatchJob& job, const EncodeOptions& encode) {
+	const fs::path parent = fs::path(job._output).parent_path();
+
+	std::error_code error;
+	if(!parent.empty() && !fs::create_directories(parent, error) && error) {
+		std::cout << "Unable to create directory -- " << parent.string() << '\n';
+		return false;
+	}
+
+	ImageReader image_reader(job._input);
+
+	auto image = image_reader.release();
+	if(!image) {
+		return false;
+	}
+
+	if(image->get_type() == TYPE_BMP) {
+		auto png = std::move(*image).to_png();
+		return png.save(job._output.c_str(), encode);
+	}
+
+	auto bmp = std::move(*image).to_bmp();
+	return bmp.save(job._output.c_str(), 0);
+}
+
+BatchResult run_batch(const std::vector<BatchJob>& jobs, const BatchOptions& options) {
+	using namespace std::chrono;
+
+	BatchResult result;
+
+	ThreadPool pool(options._threads);
+
+	// enough files to keep every thread busy, splitting each one as well only adds overhead
+	const bool file_parallel = jobs.size() >= size_t(pool.size());
+
+	EncodeOptions encode = options._encode;
+	const int threads = decode_threads();
+
+	if(file_parallel) {
+		encode._threads = 1;
+		set_decode_threads(1);
+	}
+
+	std::atomic<int> converted { 0 };
+	std::atomic<int> failed { 0 };
+	std::atomic<uint64_t> bytes { 0 };
+
+	const auto start = steady_clock::now();
+
+	for (const auto& job : jobs) {
+		pool.submit([&, job_ptr = &job]() {
+			if(convert_file(*job_ptr, encode)) {
+				++converted;
+				bytes += job_ptr->_size;
+			}
+			else {
+				std::cout << "Failed to convert " << job_ptr->_input << '\n';
+				++failed;
+			}
+		});
+	}
+
+	pool.wait();
+
+	result._seconds = duration<double>(steady_clock::now() - start).count();
+	result._converted = converted;
+	result._failed = failed;
+	result._bytes = bytes;
+
+	set_decode_threads(threads);
+
+	return result;
+}
+
+void print_batch_result(const BatchResult& result) {
+	const double seconds = std::max(result._seconds, 1e-9);
+	const double mb = double(result._bytes) / (1024 * 1024);
+
+	std::cout << "Converted: " << result._converted << " files, " << result._failed << " failed" << '\n';
+	std::cout << "Input: " << mb << " MB in " << result._seconds << " s" << '\n';
+	std::cout << "Throughput: " << result._converted / seconds << " files/s, " << mb / seconds << " MB/s" << '\n';
+}
@@ -0,0 +1,41 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Encoder.h"
+
+struct BatchJob {
+	std::string _input;
+	std::string _output;  // without extension, save adds it
+	uint64_t _size;
+};
+
+struct BatchOptions {
+	int _threads = 0;  // pool size, 0 is one per core
+	EncodeOptions _encode = effort_options(DEFAULT_EFFORT);
+	std::string _out;  // empty writes each output next to its input
+};
+
+struct BatchResult {
+	int _converted = 0;
+	int _failed = 0;
+	uint64_t _bytes = 0;  // input bytes of the converted files
+	double _seconds = 0;
+};
+
+// Turns inputs into jobs, each one a file, a directory (searched recursively for .png and .bmp), a glob with * or ? in the
+// file name, or @list naming a text file with one input per line
+// PNGs become BMPs and BMPs PNGs, under out the relative path below a directory input is kept
+// a job whose output would land on another input or another job's output is left out, jobs come back largest first
+bool collect_batch_jobs(const std::vector<std::string>& inputs, const std::string& out, std::vector<BatchJob>& jobs);
+
+// Converts every job on a work stealing pool, in the given order
+// with at least as many jobs as threads each file decodes and encodes on one thread, otherwise on all of them
+BatchResult run_batch(const std::vector<BatchJob>& jobs, const BatchOptions& options);
+
+void print_batch_result(const BatchResult& result);
+
+#endif
@@ -0,0 +1,310 @@
+#include "Checksum.h"
+#include "Cpu.h"
+
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#include <wmmintrin.h>
+#endif
+
+static std::atomic<ChecksumPolicy> current_policy { DEFAULT_CHECKSUM_POLICY };
+
+void set_checksum_policy(ChecksumPolicy policy) {
+	current_policy.store(policy, std::memory_order_relaxed);
+}
+
+ChecksumPolicy checksum_policy() {
+	return current_policy.load(std::memory_order_relaxed);
+}
+
+const char* checksum_policy_name(ChecksumPolicy policy) {
+	switch (policy) {
+	case ChecksumPolicy::Off:		return "off";
+	case ChecksumPolicy::Critical:	return "critical";
+	case ChecksumPolicy::All:		return "all";
+	}
+	return "";
+}
+
+bool verify_chunk_crc(const char* type) {
+	switch (checksum_policy()) {
+	case ChecksumPolicy::Off:		return false;
+	case ChecksumPolicy::Critical:	return (type[0] & 0x20) == 0;  // uppercase first letter
+	case ChecksumPolicy::All:		return true;
+	}
+	return false;
+}
+
+bool verify_adler32() {
+	return checksum_policy() != ChecksumPolicy::Off;
+}
+
+// *********************************************************************************************************************************************************************************************************************
+
+constexpr uint32_t CRC_POLYNOMIAL = 0xedb88320;  // 0x04c11db7 reflected
+
+// tables[n][byte] is the crc of byte followed by n zero bytes, so eight bytes can be looked up at once
+struct CrcTables {
+	uint32_t _tables[8][256];
+
+	CrcTables() {
+		for (uint32_t byte = 0; byte < 256; ++byte) {
+			uint32_t crc = byte;
+			for (int bit = 0; bit < 8; ++bit) {
+				crc = crc & 1 ? (crc >> 1) ^ CRC_POLYNOMIAL : crc >> 1;
+			}
+			_tables[0][byte] = crc;
+		}
+
+		for (int n = 1; n < 8; ++n) {
+			for (int byte = 0; byte < 256; ++byte) {
+				const uint32_t previous = _tables[n - 1][byte];
+				_tables[n][byte] = (previous >> 8) ^ _tables[0][previous & 0xff];
+			}
+		}
+	}
+};
+
+static const CrcTables& crc_tables() {
+	static const CrcTables tables;
+	return tables;
+}
+
+// Works on the inverted crc, little endian loads
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t* data, size_t size) {
+	const auto& t = crc_tables()._tables;
+
+	for (; size >= 8; data += 8, size -= 8) {
+		uint32_t low, high;
+		memcpy(&low, data, 4);
+		memcpy(&high, data + 4, 4);
+
+		low ^= crc;
+
+		crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+			  t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+	}
+
+	for (; size > 0; ++data, --size) {
+		crc = t[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+	}
+
+	return crc;
+}
+
+#ifdef CPU_X86
+
+// Moves lane 128 bits further along and adds it to next
+CPU_TARGET("pclmul")
+static inline __m128i fold_128(__m128i lane, __m128i next, __m128i constants) {
+	const __m128i low = _mm_clmulepi64_si128(lane, constants, 0x00);
+	const __m128i high = _mm_clmulepi64_si128(lane, constants, 0x11);
+
+	return _mm_xor_si128(_mm_xor_si128(high, low), next);
+}
+
+// Carry-less multiply folding from Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ"
+// four 128 bit lanes fold 64 bytes per step, then fold into one lane, down to 64 bits and Barrett reduce to 32
+// size has to be a multiple of 16 and at least 64, works on the inverted crc like the slice version
+CPU_TARGET("pclmul")
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t* data, size_t size) {
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);  // x^(4*128+32), x^(4*128-32) mod P
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);  // x^(128+32), x^(128-32) mod P
+	const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);                // x^64 mod P
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);   // P and its Barrett constant
+	const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+	__m128i x1 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+	__m128i x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+	__m128i x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+	__m128i x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(int(crc)));
+
+	data += 64;
+	size -= 64;
+
+	for (; size >= 64; data += 64, size -= 64) {
+		const __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		const __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		const __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		const __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(data + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(data + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(data + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(data + 0x30)));
+	}
+
+	// four lanes into one, then whatever 16 byte blocks are left
+	x1 = fold_128(x1, x2, k3k4);
+	x1 = fold_128(x1, x3, k3k4);
+	x1 = fold_128(x1, x4, k3k4);
+
+	for (; size >= 16; data += 16, size -= 16) {
+		x1 = fold_128(x1, _mm_loadu_si128((const __m128i*)data), k3k4);
+	}
+
+	// 128 bits to 64
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, low32);
+	x1 = _mm_clmulepi64_si128(x1, k5, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x2 = _mm_and_si128(x1, low32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, low32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return uint32_t(_mm_cvtsi128_si32(_mm_srli_si128(x1, 4)));
+}
+
+#endif
+
+// Adler-32 sums, s1 of the bytes and s2 of the running s1, both mod 65521
+constexpr uint32_t ADLER_BASE = 65521;
+constexpr size_t ADLER_NMAX = 5552;  // most bytes before s2 can overflow 32 bits
+
+static uint32_t adler32_scalar(uint32_t adler, const uint8_t* data, size_t size) {
+	uint32_t s1 = adler & 0xffff;
+	uint32_t s2 = adler >> 16;
+
+	while (size > 0) {
+		const size_t count = std::min(size, ADLER_NMAX);
+
+		for (size_t i = 0; i < count; ++i) {
+			s1 += data[i];
+			s2 += s1;
+		}
+
+		s1 %= ADLER_BASE;
+		s2 %= ADLER_BASE;
+
+		data += count;
+		size -= count;
+	}
+
+	return s1 | (s2 << 16);
+}
+
+#ifdef CPU_X86
+
+// 32 bytes per step, psadbw adds them up for s1 and pmaddubsw weights them 32..1 for s2
+// s2 also gets 32 times every s1 from before the step, kept in v_ps and added at the end of each run
+CPU_TARGET("ssse3")
+static uint32_t adler32_ssse3(uint32_t adler, const uint8_t* data, size_t size) {
+	constexpr size_t BLOCK = 32;
+
+	uint32_t s1 = adler & 0xffff;
+	uint32_t s2 = adler >> 16;
+
+	size_t blocks = size / BLOCK;
+	size -= blocks * BLOCK;
+
+	const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+	const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi16(1);
+
+	while (blocks > 0) {
+		size_t run = std::min(blocks, ADLER_NMAX / BLOCK);
+		blocks -= run;
+
+		__m128i v_ps = _mm_cvtsi32_si128(int(s1 * run));
+		__m128i v_s2 = _mm_cvtsi32_si128(int(s2));
+		__m128i v_s1 = zero;
+
+		for (; run > 0; --run, data += BLOCK) {
+			const __m128i bytes1 = _mm_loadu_si128((const __m128i*)data);
+			const __m128i bytes2 = _mm_loadu_si128((const __m128i*)(data + 16));
+
+			v_ps = _mm_add_epi32(v_ps, v_s1);
+
+			v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+			v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+			v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+			v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+		}
+
+		v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+		v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(2, 3, 0, 1)));
+		v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+		v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+		v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+
+		s1 = (s1 + uint32_t(_mm_cvtsi128_si32(v_s1))) % ADLER_BASE;
+		s2 = uint32_t(_mm_cvtsi128_si32(v_s2)) % ADLER_BASE;
+	}
+
+	return adler32_scalar(s1 | (s2 << 16), data, size);
+}
+
+#endif
+
+// *********************************************************************************************************************************************************************************************************************
+
+static ChecksumKernels best_checksum_kernels() {
+	const auto& cpu = cpu_features();
+
+	if(cpu._pclmul || cpu._ssse3)	return ChecksumKernels::SIMD;
+
+	return ChecksumKernels::Scalar;
+}
+
+static std::atomic<ChecksumKernels> active_checksum_kernels { best_checksum_kernels() };
+
+ChecksumKernels set_checksum_kernels(ChecksumKernels kernels) {
+	const ChecksumKernels best = best_checksum_kernels();
+
+	active_checksum_kernels = int(kernels) > int(best) ? best : kernels;
+
+	return active_checksum_kernels;
+}
+
+ChecksumKernels checksum_kernels() {
+	return active_checksum_kernels;
+}
+
+uint32_t update_crc32(uint32_t crc, const char* data, size_t size) {
+	const uint8_t* bytes = (const uint8_t*)data;
+
+	crc = ~crc;
+
+#ifdef CPU_X86
+	if(size >= 64 && cpu_features()._pclmul && active_checksum_kernels.load(std::memory_order_relaxed) == ChecksumKernels::SIMD) {
+		const size_t folded = size & ~size_t(15);
+
+		crc = crc32_pclmul(crc, bytes, folded);
+		bytes += folded;
+		size -= folded;
+	}
+#endif
+
+	return ~crc32_slice8(crc, bytes, size);
+}
+
+uint32_t update_adler32(uint32_t adler, const char* data, size_t size) {
+	const uint8_t* bytes = (const uint8_t*)data;
+
+#ifdef CPU_X86
+	if(cpu_features()._ssse3 && active_checksum_kernels.load(std::memory_order_relaxed) == ChecksumKernels::SIMD) {
+		return adler32_ssse3(adler, bytes, size);
+	}
+#endif
+
+	return adler32_scalar(adler, bytes, size);
+}
@@ -0,0 +1,36 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Which checksums are verified while reading PNGs
+// Critical checks the crc of IHDR, PLTE, IDAT and IEND, All of every chunk, both check the Adler-32 of the zlib stream too
+// a critical chunk that fails stops the read, an ancillary one is skipped
+enum class ChecksumPolicy { Off, Critical, All };
+
+#define DEFAULT_CHECKSUM_POLICY ChecksumPolicy::Critical
+
+void set_checksum_policy(ChecksumPolicy policy);
+ChecksumPolicy checksum_policy();
+
+const char* checksum_policy_name(ChecksumPolicy policy);
+
+bool verify_chunk_crc(const char* type);  // whether the policy covers chunks of this type
+bool verify_adler32();                    // false only when the policy is Off
+
+// Scalar is slice-by-8 for the crc and a plain loop for adler, SIMD folds the crc with PCLMULQDQ and sums adler with SSSE3
+// each where the cpu has it, SIMD is picked at startup when either is there
+enum class ChecksumKernels { Scalar, SIMD };
+
+// Overrides the dispatch, SIMD on a cpu without it falls back to Scalar
+ChecksumKernels set_checksum_kernels(ChecksumKernels kernels);
+ChecksumKernels checksum_kernels();
+
+// CRC-32 as PNG and zlib use it, start from 0 and pass the result back in to continue over more data
+uint32_t update_crc32(uint32_t crc, const char* data, size_t size);
+
+// Adler-32 as zlib uses it, start from 1
+uint32_t update_adler32(uint32_t adler, const char* data, size_t size);
+
+#endif
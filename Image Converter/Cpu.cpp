@@ -0,0 +1,45 @@
+#include "Cpu.h"
+
+#if defined(CPU_X86) && defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+static CpuFeatures detect_cpu_features() {
+	CpuFeatures features;
+
+#if defined(CPU_X86) && defined(_MSC_VER) && !defined(__clang__)
+	int info[4] = { 0, 0, 0, 0 };
+
+	__cpuid(info, 0);
+	const int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	features._sse2 = (info[3] & (1 << 26)) != 0;
+	features._ssse3 = (info[2] & (1 << 9)) != 0;
+	features._sse41 = (info[2] & (1 << 19)) != 0;
+	features._pclmul = (info[2] & (1 << 1)) != 0;
+
+	const bool os_saves_avx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6; // OSXSAVE, XMM and YMM state
+
+	if(max_leaf >= 7 && os_saves_avx) {
+		__cpuidex(info, 7, 0);
+		features._avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#elif defined(CPU_X86)
+	__builtin_cpu_init();
+
+	features._sse2 = __builtin_cpu_supports("sse2");
+	features._ssse3 = __builtin_cpu_supports("ssse3");
+	features._sse41 = __builtin_cpu_supports("sse4.1");
+	features._avx2 = __builtin_cpu_supports("avx2");
+	features._pclmul = __builtin_cpu_supports("pclmul");
+#endif
+
+	return features;
+}
+
+const CpuFeatures& cpu_features() {
+	static const CpuFeatures features = detect_cpu_features();
+	return features;
+}
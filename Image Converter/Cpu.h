@@ -0,0 +1,26 @@
+#ifndef CPU_H
+#define CPU_H
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#endif
+
+// MSVC lets any function use any instruction set, gcc and clang need it spelled out per function
+#if defined(_MSC_VER) && !defined(__clang__)
+#define CPU_TARGET(features)
+#else
+#define CPU_TARGET(features) __attribute__((target(features)))
+#endif
+
+struct CpuFeatures {
+	bool _sse2 = false;
+	bool _ssse3 = false;
+	bool _sse41 = false;
+	bool _avx2 = false;
+	bool _pclmul = false;
+};
+
+// Detected once, includes the OS check for saving AVX state
+const CpuFeatures& cpu_features();
+
+#endif
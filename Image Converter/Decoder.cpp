@@ -0,0 +1,692 @@
+#include "Decoder.h"
+#include "Image.h"
+#include "Filter.h"
+#include "Checksum.h"
+#include "Progress.h"
+#include "Parallel.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <future>
+
+#include <zlib.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+constexpr char PNG_SIGNATURE[8] = { '\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n' };
+
+static int read_big_endian(const char* ptr) {
+	unsigned int value;
+	memcpy(&value, ptr, sizeof(value));
+	return int(_byteswap_ulong(value));
+}
+
+// *********************************************************************************************************************************************************************************************************************
+
+ScanlineDecoder::ScanlineDecoder(int bytes_per_row, int bytes_per_pixel, int rows, RowSink sink, InflateBackend backend) :
+	_inflater			( make_inflater(backend) ),
+	_current			( size_t(bytes_per_row) + 1, 0 ),
+	_previous			( size_t(bytes_per_row) + 1, 0 ),
+	_filled				( 0 ),
+	_bytes_per_row		( bytes_per_row ),
+	_bytes_per_pixel	( bytes_per_pixel ),
+	_row				( 0 ),
+	_rows				( rows ),
+	_error				( false ),
+	_sink				( std::move(sink) )
+{
+	_error = _inflater->failed();
+}
+
+ScanlineDecoder::~ScanlineDecoder() = default;
+
+bool ScanlineDecoder::feed(const char* data, size_t size) {
+	if(_error) {
+		return false;
+	}
+
+	_inflater->feed(data, size);
+
+	return !_inflater->streaming() || drain();
+}
+
+bool ScanlineDecoder::finish() {
+	if(_error) {
+		return false;
+	}
+
+	_inflater->finish();
+
+	return drain();
+}
+
+bool ScanlineDecoder::drain() {
+	while (true) {
+		_filled += _inflater->read(&_current[_filled], _current.size() - _filled);
+
+		if(_inflater->failed()) {
+			_error = true;
+			return false;
+		}
+
+		if(_filled < _current.size()) { // needs more input, or the stream has ended
+			break;
+		}
+
+		if(_row == _rows) { // only the adler32 trailer is left, anything else is excess and dropped
+			_filled = 0;
+			continue;
+		}
+
+		emit_row();
+
+		if(_error) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void ScanlineDecoder::emit_row() {
+	if(!unfilter_scanline(uint8_t(_current[0]), &_current[1], &_previous[1], _bytes_per_row, _bytes_per_pixel)) {
+		_error = true;
+		return;
+	}
+
+	if(_sink) {
+		_sink(_row, &_current[1]);
+	}
+
+	std::swap(_current, _previous);
+	_filled = 0;
+	++_row;
+}
+
+bool ScanlineDecoder::done() const {
+	return _row == _rows;
+}
+
+int ScanlineDecoder::rows_decoded() const {
+	return _row;
+}
+
+// *********************************************************************************************************************************************************************************************************************
+
+PNGStreamDecoder::PNGStreamDecoder(PNG& png, RowSink sink) :
+	_png				( png ),
+	_sink				( std::move(sink) ),
+	_state				( State::Signature ),
+	_header_filled		( 0 ),
+	_chunk_remaining	( 0 ),
+	_chunk_length		( 0 ),
+	_chunk_is_idat		( false ),
+	_chunk_is_parsed	( false ),
+	_chunk_verified		( false ),
+	_crc				( 0 ),
+	_consumed			( 0 )
+{}
+
+PNGStreamDecoder::~PNGStreamDecoder() = default;
+
+bool PNGStreamDecoder::push(const char* data, size_t size) {
+	_consumed += size;
+
+	while (size > 0) {
+		switch (_state) {
+		case State::Signature:
+		case State::ChunkHeader:
+		case State::ChunkCrc: {
+			const size_t need = _state == State::ChunkCrc ? 4 : 8;
+			const size_t count = std::min(need - _header_filled, size);
+
+			memcpy(&_header[_header_filled], data, count);
+			_header_filled += count;
+			data += count;
+			size -= count;
+
+			if(_header_filled < need) {
+				break;
+			}
+			_header_filled = 0;
+
+			if(_state == State::Signature) {
+				if(memcmp(_header, PNG_SIGNATURE, 8) != 0) {
+					return fail("Not a PNG file");
+				}
+				memcpy(&_png._signature, _header, 8);
+				_png._signature = _byteswap_uint64(_png._signature);
+				_state = State::ChunkHeader;
+			}
+			else if(_state == State::ChunkHeader) {
+				if(!start_chunk()) {
+					return false;
+				}
+			}
+			else if(!end_chunk()) {
+				return false;
+			}
+			break;
+		}
+		case State::ChunkData: {
+			const size_t count = std::min(_chunk_remaining, size);
+
+			if(_chunk_verified) {
+				_crc = update_crc32(_crc, data, count);
+			}
+
+			if(_chunk_is_idat) {
+				if(!_rows->feed(data, count)) {
+					return fail("Corrupt IDAT data");
+				}
+			}
+			else if(_chunk_is_parsed) {
+				_chunk.insert(_chunk.end(), data, data + count);
+			}
+
+			_chunk_remaining -= count;
+			data += count;
+			size -= count;
+
+			if(_chunk_remaining == 0) {
+				_state = State::ChunkCrc;
+			}
+			break;
+		}
+		case State::End: // trailing bytes after IEND are ignored
+			return true;
+		case State::Error:
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool PNGStreamDecoder::start_chunk() {
+	_chunk_length = read_big_endian(_header);
+	memcpy(_chunk_type, &_header[4], 4);
+
+	if(_chunk_length < 0) {
+		return fail("Invalid PNG chunk length");
+	}
+
+	_chunk_remaining = size_t(_chunk_length);
+	_chunk_is_idat = memcmp(_chunk_type, "IDAT", 4) == 0;
+	_chunk_is_parsed = PNG::is_parsed_chunk(_chunk_type);
+	_chunk_verified = verify_chunk_crc(_chunk_type);
+	_crc = _chunk_verified ? update_crc32(0, _chunk_type, 4) : 0;
+	_chunk.clear();
+
+	if(_chunk_is_idat && !_rows && !start_image()) {
+		return false;
+	}
+
+	_state = _chunk_remaining ? State::ChunkData : State::ChunkCrc;
+
+	return true;
+}
+
+bool PNGStreamDecoder::end_chunk() {
+	if(_chunk_verified && _crc != uint32_t(read_big_endian(_header))) {
+		if(_chunk_type[0] & 0x20) { // ancillary, skipped
+			std::cout << "CRC mismatch in " << std::string_view(_chunk_type, 4) << " chunk" << '\n';
+			_state = State::ChunkHeader;
+			return true;
+		}
+
+		// IDAT data already went to the decoder, but the rows are only trusted once the stream finishes
+		return fail("CRC mismatch in critical PNG chunk");
+	}
+
+	if(_chunk_is_parsed) {
+		_chunk.insert(_chunk.end(), _header, _header + 4); // read_* functions expect the crc after the data
+		_png.read_chunk(_chunk_type, _chunk_length, _chunk.data());
+	}
+
+	if(memcmp(_chunk_type, "IEND", 4) == 0) {
+		if(!_rows || !_rows->finish() || !_rows->done()) {
+			return fail("PNG ended before all rows were decoded");
+		}
+		_state = State::End;
+		return true;
+	}
+
+	_state = State::ChunkHeader;
+
+	return true;
+}
+
+bool PNGStreamDecoder::start_image() {
+	const auto& ihdr = _png._ihdr_chunk;
+
+	if(ihdr._width <= 0 || ihdr._height <= 0) {
+		return fail("IDAT before IHDR");
+	}
+
+	if(ihdr._interlace != 0) {
+		return fail("Interlaced PNGs are not supported");
+	}
+
+	const int bytes_per_row = _png.bytes_per_row();
+
+	RowSink sink = _sink;
+	if(!sink) {
+		_png._pixels.resize(size_t(bytes_per_row) * ihdr._height);
+
+		sink = [this, bytes_per_row](int row, const char* pixels) {
+			memcpy(&_png._pixels[size_t(row) * bytes_per_row], pixels, bytes_per_row);
+		};
+	}
+
+	// pushed blocks are gone once push returns, which only a streaming inflater can work with
+	_rows = std::make_unique<ScanlineDecoder>(bytes_per_row, _png.bytes_per_pixel(), ihdr._height, std::move(sink), InflateBackend::Zlib);
+
+	return true;
+}
+
+bool PNGStreamDecoder::fail(const char* reason) {
+	std::cout << reason << '\n';
+	_state = State::Error;
+	return false;
+}
+
+bool PNGStreamDecoder::finished() const {
+	return _state == State::End;
+}
+
+bool PNGStreamDecoder::failed() const {
+	return _state == State::Error;
+}
+
+size_t PNGStreamDecoder::bytes_consumed() const {
+	return _consumed;
+}
+
+// *********************************************************************************************************************************************************************************************************************
+
+constexpr size_t MIN_SEGMENT_SIZE = 1 << 16;  // compressed bytes, less isn't worth handing to a thread
+constexpr size_t DICTIONARY_SIZE = 1 << 15;
+
+static std::atomic<int> default_decode_threads { hardware_threads() };
+
+void set_decode_threads(int threads) {
+	default_decode_threads.store(std::max(1, threads), std::memory_order_relaxed);
+}
+
+int decode_threads() {
+	return default_decode_threads.load(std::memory_order_relaxed);
+}
+
+// The pieces addressed as one stream
+class JoinedStream {
+public:
+	JoinedStream(const std::vector<StreamPiece>& pieces) :
+		_pieces	( pieces ),
+		_size	( 0 )
+	{
+		for (auto& piece : pieces) {
+			_starts.push_back(_size);
+			_size += piece._size;
+		}
+	}
+
+	size_t size() const {
+		return _size;
+	}
+
+	uint8_t at(size_t offset) const {
+		const size_t index = std::upper_bound(_starts.begin(), _starts.end(), offset) - _starts.begin() - 1;
+		return uint8_t(_pieces[index]._data[offset - _starts[index]]);
+	}
+
+	// Calls read(data, size) for each part of [begin, end) in order, stops when it returns false
+	template<typename Read>
+	void for_each(size_t begin, size_t end, Read read) const {
+		size_t index = std::upper_bound(_starts.begin(), _starts.end(), begin) - _starts.begin() - 1;
+
+		while (begin < end && index < _pieces.size()) {
+			const size_t offset = begin - _starts[index];
+			const size_t count = std::min(_pieces[index]._size - offset, end - begin);
+
+			if(count > 0 && !read(_pieces[index]._data + offset, count)) {
+				return;
+			}
+
+			begin += count;
+			++index;
+		}
+	}
+
+	// Offsets just past every 00 00 ff ff, the length of an empty stored block, some may be chance matches inside compressed data
+	std::vector<size_t> flush_points() const {
+		std::vector<size_t> points;
+
+		for (size_t index = 0; index < _pieces.size(); ++index) {
+			const char* data = _pieces[index]._data;
+			const char* end = data + _pieces[index]._size;
+
+			for (const char* ptr = data; (ptr = (const char*)memchr(ptr, 0xff, end - ptr)) != nullptr; ++ptr) {
+				const size_t offset = _starts[index] + (ptr - data);
+
+				if(offset >= 4 && offset + 1 < _size && at(offset + 1) == 0xff && at(offset - 1) == 0 && at(offset - 2) == 0) {
+					points.push_back(offset + 2);
+				}
+			}
+		}
+
+		return points;
+	}
+private:
+	const std::vector<StreamPiece>& _pieces;
+	std::vector<size_t> _starts;
+	size_t _size;
+};
+
+struct Segment {
+	size_t _begin;  // raw deflate data from here
+	size_t _end;    // to where the next segment begins, or the end of the stream
+	bool _last;
+
+	std::vector<char> _output;
+	uint32_t _adler;
+	size_t _trailer;  // last segment only, where the adler32 trailer starts
+	bool _ok;
+};
+
+// Raw inflates one segment, the last has to finish the deflate stream and the others have to stop exactly on a block boundary
+// anything else, including a reference back past the start without a dictionary, fails the segment
+static bool inflate_segment(const JoinedStream& stream, Segment& segment, size_t max_output, const char* dictionary, size_t dictionary_size) {
+	z_stream zs;
+	zs.zalloc = Z_NULL;
+	zs.zfree = Z_NULL;
+	zs.opaque = Z_NULL;
+	zs.avail_in = 0;
+	zs.next_in = Z_NULL;
+
+	if(inflateInit2(&zs, -15) != Z_OK) {
+		return false;
+	}
+
+	bool ok = dictionary_size == 0 || inflateSetDictionary(&zs, (const Bytef*)dictionary, uInt(dictionary_size)) == Z_OK;
+
+	std::vector<char>& output = segment._output;
+	output.resize(std::min(max_output, std::max<size_t>(1 << 16, (segment._end - segment._begin) * 4)));
+
+	size_t filled = 0;
+	int ret = Z_OK;
+
+	stream.for_each(segment._begin, segment._end, [&](const char* data, size_t size) {
+		zs.next_in = (Bytef*)data;
+		zs.avail_in = uInt(size);
+
+		do {
+			if(filled == output.size()) {
+				if(output.size() == max_output) { // more than the whole image, not a segment of this stream
+					ok = false;
+					break;
+				}
+				output.resize(std::min(max_output, output.size() * 2));
+			}
+
+			zs.next_out = (Bytef*)&output[filled];
+			zs.avail_out = uInt(std::min(output.size() - filled, size_t(1) << 30));
+
+			ret = inflate(&zs, segment._last ? Z_NO_FLUSH : Z_BLOCK);
+
+			filled = size_t((char*)zs.next_out - output.data());
+
+			if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+				ok = false;
+			}
+		} while (ok && ret != Z_STREAM_END && (zs.avail_in > 0 || zs.avail_out == 0));
+
+		return ok && ret != Z_STREAM_END;
+	});
+
+	if(segment._last) {
+		ok = ok && ret == Z_STREAM_END && segment._begin + zs.total_in + 4 <= stream.size();
+		segment._trailer = segment._begin + zs.total_in;
+	}
+	else { // every byte used, between blocks, not in the final one, nothing left over in the bit buffer
+		ok = ok && ret != Z_STREAM_END && zs.avail_in == 0 && (zs.data_type & (128 | 64 | 7)) == 128;
+	}
+
+	inflateEnd(&zs);
+
+	output.resize(ok ? filled : 0);
+	segment._adler = update_adler32(1, output.data(), output.size());
+	segment._ok = ok;
+
+	return ok;
+}
+
+// Splits at flush points and inflates every segment, returns false if the stream can't be split or doesn't check out
+static bool inflate_segments(const JoinedStream& stream, std::vector<Segment>& segments, size_t max_output, int threads) {
+	if(stream.size() < 2 * MIN_SEGMENT_SIZE || threads <= 1) {
+		return false;
+	}
+
+	const uint8_t cmf = stream.at(0);
+	const uint8_t flg = stream.at(1);
+
+	if((cmf & 0x0f) != 8 || (cmf * 256 + flg) % 31 != 0 || (flg & 0x20)) { // deflate, valid check bits, no preset dictionary
+		return false;
+	}
+
+	const size_t min_size = std::max(MIN_SEGMENT_SIZE, stream.size() / (size_t(threads) * 4));
+
+	size_t begin = 2;
+	for (size_t point : stream.flush_points()) {
+		if(point - begin >= min_size && stream.size() - point >= min_size) {
+			segments.push_back({ begin, point, false });
+			begin = point;
+		}
+	}
+
+	if(segments.empty()) {
+		return false;
+	}
+
+	segments.push_back({ begin, stream.size(), true });
+
+	std::atomic<int> inflated { 0 };
+
+	run_parallel(threads, int(segments.size()), [&](int index) {
+		inflate_segment(stream, segments[index], max_output, nullptr, 0);
+
+		report_progress("Decompressing", ++inflated, int(segments.size()));
+	});
+
+	// Z_SYNC_FLUSH keeps the window, segments that refer back into the previous one go again in order with it as dictionary
+	// one that still fails ends on a chance 00 00 ff ff, it takes in the next segment and tries again
+	std::vector<char> dictionary;
+
+	for (size_t index = 0; index < segments.size(); ++index) {
+		if(segments[index]._ok) {
+			continue;
+		}
+
+		dictionary.clear();
+		for (size_t previous = index; previous-- > 0 && dictionary.size() < DICTIONARY_SIZE;) {
+			const std::vector<char>& output = segments[previous]._output;
+			const size_t count = std::min(output.size(), DICTIONARY_SIZE - dictionary.size());
+
+			dictionary.insert(dictionary.begin(), output.end() - count, output.end());
+		}
+
+		while (!inflate_segment(stream, segments[index], max_output, dictionary.data(), dictionary.size())) {
+			if(segments[index]._last) { // corrupt
+				return false;
+			}
+
+			segments[index]._end = segments[index + 1]._end;
+			segments[index]._last = segments[index + 1]._last;
+			segments.erase(segments.begin() + index + 1);
+		}
+	}
+
+	// checked whatever the checksum policy says, a wrong split at a chance 00 00 ff ff could otherwise go unnoticed
+	uLong adler = adler32(0, Z_NULL, 0);
+	for (auto& segment : segments) {
+		adler = adler32_combine(adler, segment._adler, z_off_t(segment._output.size()));
+	}
+
+	const size_t trailer = segments.back()._trailer;
+	const uLong expected = uLong(stream.at(trailer)) << 24 | uLong(stream.at(trailer + 1)) << 16 | uLong(stream.at(trailer + 2)) << 8 | stream.at(trailer + 3);
+
+	return adler == expected;
+}
+
+bool decode_scanlines_parallel(const std::vector<StreamPiece>& pieces, int bytes_per_row, int bytes_per_pixel, int rows, const RowSink& sink, int threads) {
+	const JoinedStream stream(pieces);
+	const size_t stride = size_t(bytes_per_row) + 1;
+
+	std::vector<Segment> segments;
+
+	if(!inflate_segments(stream, segments, stride * rows, threads)) { // one thread, in order
+		ScanlineDecoder decoder(bytes_per_row, bytes_per_pixel, rows, sink);
+
+		bool ok = true;
+		for (auto& piece : pieces) {
+			if(!decoder.feed(piece._data, piece._size)) {
+				ok = false;
+				break;
+			}
+		}
+
+		return ok && decoder.finish() && decoder.done();
+	}
+
+	std::vector<size_t> starts;
+	size_t total = 0;
+	for (auto& segment : segments) {
+		starts.push_back(total);
+		total += segment._output.size();
+	}
+
+	if(total < stride * rows) {
+		return false;
+	}
+
+	// a row can straddle two segments, so each is copied out before defiltering it in place
+	auto copy_row = [&](int row, char* out) {
+		size_t offset = size_t(row) * stride;
+		size_t index = std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin() - 1;
+
+		for (size_t remaining = stride; remaining > 0; ++index) {
+			const std::vector<char>& output = segments[index]._output;
+			const size_t count = std::min(remaining, output.size() - (offset - starts[index]));
+
+			memcpy(out, &output[offset - starts[index]], count);
+
+			out += count;
+			offset += count;
+			remaining -= count;
+		}
+	};
+
+	const int band_count = std::min(rows, threads * 4);
+
+	std::vector<std::vector<char>> last_rows(band_count);
+	std::vector<std::promise<void>> band_done(band_count);
+	std::vector<std::future<void>> band_ready;
+	for (auto& done : band_done) {
+		band_ready.push_back(done.get_future());
+	}
+
+	std::atomic<bool> error { false };
+	std::atomic<int> defiltered { 0 };
+
+	run_parallel(threads, band_count, [&](int band) {
+		const int first = int(int64_t(rows) * band / band_count);
+		const int last = int(int64_t(rows) * (band + 1) / band_count);
+
+		std::vector<char> current(stride);
+		std::vector<char> previous(stride, 0);
+
+		copy_row(first, current.data());
+
+		// None and Sub don't look at the row above, anything else has to wait for the band above to finish
+		const int filter = uint8_t(current[0]);
+		if(band > 0 && filter != FILTER_NONE && filter != FILTER_SUB) {
+			band_ready[band - 1].wait();
+			previous = last_rows[band - 1];
+		}
+
+		for (int row = first; row < last && !error; ++row) {
+			if(row > first) {
+				copy_row(row, current.data());
+			}
+
+			if(!unfilter_scanline(uint8_t(current[0]), &current[1], &previous[1], bytes_per_row, bytes_per_pixel)) {
+				error = true;
+				break;
+			}
+
+			sink(row, &current[1]);
+
+			std::swap(current, previous);
+		}
+
+		last_rows[band] = std::move(previous);
+		band_done[band].set_value();
+
+		report_progress("Defiltering", ++defiltered, band_count);
+	});
+
+	return !error;
+}
+
+// *********************************************************************************************************************************************************************************************************************
+
+constexpr size_t STREAM_BLOCK_SIZE = 1 << 16;
+
+bool decode_png(std::FILE* file, PNG& png, RowSink sink) {
+	PNGStreamDecoder decoder(png, std::move(sink));
+
+	std::vector<char> block(STREAM_BLOCK_SIZE);
+
+	size_t count = 0;
+	while (!decoder.finished() && (count = fread(block.data(), 1, block.size(), file)) > 0) {
+		if(!decoder.push(block.data(), count)) {
+			return false;
+		}
+	}
+
+	png._file_size = int(decoder.bytes_consumed());
+
+	return decoder.finished();
+}
+
+bool decode_png_fd(int fd, PNG& png, RowSink sink) {
+	PNGStreamDecoder decoder(png, std::move(sink));
+
+	std::vector<char> block(STREAM_BLOCK_SIZE);
+
+	while (!decoder.finished()) {
+#ifdef _WIN32
+		const int count = _read(fd, block.data(), unsigned(block.size()));
+#else
+		const ssize_t count = ::read(fd, block.data(), block.size());
+#endif
+		if(count <= 0) {
+			break;
+		}
+
+		if(!decoder.push(block.data(), size_t(count))) {
+			return false;
+		}
+	}
+
+	png._file_size = int(decoder.bytes_consumed());
+
+	return decoder.finished();
+}
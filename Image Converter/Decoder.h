@@ -0,0 +1,109 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include "Image.h"
+#include "Inflate.h"
+
+#include <memory>
+#include <vector>
+#include <cstdio>
+
+// Inflates a zlib stream of filtered scanlines and defilters each row as it comes out
+// inflate writes into a two row ring (the row being filled and the one above it), so the working set stays in cache
+class ScanlineDecoder {
+public:
+	ScanlineDecoder(int bytes_per_row, int bytes_per_pixel, int rows, RowSink sink, InflateBackend backend = inflate_backend());
+	~ScanlineDecoder();
+
+	ScanlineDecoder(const ScanlineDecoder&) = delete;
+	ScanlineDecoder& operator=(const ScanlineDecoder&) = delete;
+
+	bool feed(const char* data, size_t size);  // false on a corrupt stream
+	bool finish();  // after the last feed, non-streaming backends only start decoding here
+
+	bool done() const;  // every row has been emitted
+	int rows_decoded() const;
+private:
+	bool drain();
+	void emit_row();
+
+	std::unique_ptr<Inflater> _inflater;
+
+	std::vector<char> _current;   // filter byte + scanline being inflated
+	std::vector<char> _previous;  // filter byte + last reconstructed scanline
+
+	size_t _filled;
+	int _bytes_per_row;
+	int _bytes_per_pixel;
+	int _row;
+	int _rows;
+	bool _error;
+
+	RowSink _sink;
+};
+
+// Incremental PNG decoder, bytes can be pushed in pieces of any size as they arrive
+// IDAT payloads go straight to a ScanlineDecoder so the file itself is never held in memory
+class PNGStreamDecoder {
+public:
+	PNGStreamDecoder(PNG& png, RowSink sink = nullptr);  // without a sink rows are stored in png._pixels
+	~PNGStreamDecoder();
+
+	bool push(const char* data, size_t size);  // false once the stream is known to be bad
+
+	bool finished() const;  // IEND reached and every row decoded
+	bool failed() const;
+
+	size_t bytes_consumed() const;
+private:
+	enum class State { Signature, ChunkHeader, ChunkData, ChunkCrc, End, Error };
+
+	bool start_chunk();
+	bool end_chunk();
+	bool start_image();
+	bool fail(const char* reason);
+
+	PNG& _png;
+	RowSink _sink;
+
+	State _state;
+
+	char _header[8];
+	size_t _header_filled;
+
+	char _chunk_type[4];
+	size_t _chunk_remaining;
+	int _chunk_length;
+	bool _chunk_is_idat;
+	bool _chunk_is_parsed;
+	bool _chunk_verified;  // the checksum policy covers it, _crc runs over type and data
+	uint32_t _crc;
+	std::vector<char> _chunk;  // data + crc of the small chunks PNG knows how to parse
+
+	std::unique_ptr<ScanlineDecoder> _rows;
+
+	size_t _consumed;
+};
+
+// Compressed stream pieces in order, e.g. the IDAT payloads
+struct StreamPiece {
+	const char* _data;
+	size_t _size;
+};
+
+// Threads decode_scanlines_parallel uses by default, starts at the number of cores
+void set_decode_threads(int threads);
+int decode_threads();
+
+// Splits the zlib stream at its flush points (the empty stored block Z_SYNC_FLUSH and Z_FULL_FLUSH leave behind) and inflates
+// the pieces on several threads, a piece that reaches back past its start is redone with the end of the one before as dictionary
+// each thread then defilters a band of rows, waiting on the band above only when its first row needs the row above it
+// rows can reach sink out of order and from several threads at once; streams without flush points are decoded in order
+// returns false on a corrupt stream
+bool decode_scanlines_parallel(const std::vector<StreamPiece>& pieces, int bytes_per_row, int bytes_per_pixel, int rows, const RowSink& sink, int threads);
+
+// Decodes a PNG from an open file, pipe or file descriptor without reading it all in first
+bool decode_png(std::FILE* file, PNG& png, RowSink sink = nullptr);
+bool decode_png_fd(int fd, PNG& png, RowSink sink = nullptr);
+
+#endif
@@ -0,0 +1,242 @@
+#include "Encoder.h"
+#include "Filter.h"
+#include "Checksum.h"
+#include "Parallel.h"
+#include "Progress.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include <zlib.h>
+
+constexpr size_t BAND_SIZE = 1 << 20;  // unfiltered bytes per band
+
+struct Band {
+	int _first;
+	int _last;
+
+	std::vector<char> _output;  // raw deflate
+	uint32_t _adler;            // of the filtered rows
+	bool _ok;
+};
+
+// Gives deflate everything in next_in, growing the output as needed
+static bool deflate_all(z_stream& zs, std::vector<char>& output, int flush) {
+	int ret = Z_OK;
+
+	do {
+		if(zs.total_out == output.size()) {
+			output.resize(output.size() * 2);
+		}
+
+		zs.next_out = (Bytef*)&output[zs.total_out];
+		zs.avail_out = uInt(std::min(output.size() - zs.total_out, size_t(1) << 30));
+
+		ret = deflate(&zs, flush);
+
+		if(ret == Z_STREAM_ERROR) {
+			return false;
+		}
+	} while (zs.avail_in > 0 || zs.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+
+	return true;
+}
+
+// Filter and deflate strategy of one try at a band
+struct Pass {
+	FilterStrategy _filter;
+	int _strategy;
+};
+
+// Alternatives the extra passes go through in order, Up wins most bands of photos the default loses and Z_FILTERED helps flat graphics
+constexpr Pass EXTRA_PASSES[] = {
+	{ FilterStrategy::Up, Z_DEFAULT_STRATEGY },
+	{ FilterStrategy::Entropy, Z_DEFAULT_STRATEGY },
+	{ FilterStrategy::MinSum, Z_FILTERED },
+	{ FilterStrategy::Paeth, Z_DEFAULT_STRATEGY },
+	{ FilterStrategy::Sub, Z_DEFAULT_STRATEGY },
+	{ FilterStrategy::Average, Z_DEFAULT_STRATEGY },
+};
+
+constexpr int MAX_PASSES = 1 + int(sizeof(EXTRA_PASSES) / sizeof(EXTRA_PASSES[0]));
+
+// Steps picked from Benchmark --encode on photos and screenshots, zlib's Z_RLE was no faster than level 1 with Up rows
+// and compressed worse, and Z_FILTERED lost on photos, so neither is a preset of its own
+EncodeOptions effort_options(int effort) {
+	EncodeOptions options;
+	options._mem_level = 9;
+
+	switch (std::clamp(effort, MIN_EFFORT, MAX_EFFORT)) {
+	case 0:  // stored blocks, only the copy and the checksum
+		options._level = 0;
+		options._filter = FilterStrategy::None;
+		break;
+	case 1:  // up to 5 Up rows compress better than MinSum ones and filter faster, the short match searches find little else
+		options._level = 1;
+		options._filter = FilterStrategy::Up;
+		break;
+	case 2:
+		options._level = 2;
+		options._filter = FilterStrategy::Up;
+		break;
+	case 3:
+		options._level = 3;
+		options._filter = FilterStrategy::Up;
+		break;
+	case 4:
+		options._level = 4;
+		options._filter = FilterStrategy::Up;
+		break;
+	case 5:
+		options._level = 5;
+		options._filter = FilterStrategy::Up;
+		break;
+	case 6:  // the defaults
+		options._mem_level = 8;
+		break;
+	case 7:
+		options._level = 7;
+		options._filter = FilterStrategy::Entropy;
+		break;
+	case 8:
+		options._level = 9;
+		options._passes = 2;
+		break;
+	case 9:
+		options._level = 9;
+		options._passes = MAX_PASSES;
+		break;
+	}
+
+	return options;
+}
+
+static bool compress_band(const char* pixels, int bytes_per_row, int bytes_per_pixel, Band& band, const EncodeOptions& options, const Pass& pass, bool last) {
+	z_stream zs;
+	zs.zalloc = Z_NULL;
+	zs.zfree = Z_NULL;
+	zs.opaque = Z_NULL;
+
+	const int level = std::clamp(options._level, 0, 9);
+	const int window_bits = std::clamp(options._window_bits, 9, 15);
+	const int mem_level = std::clamp(options._mem_level, 1, 9);
+
+	if(deflateInit2(&zs, level, Z_DEFLATED, -window_bits, mem_level, pass._strategy) != Z_OK) {
+		return false;
+	}
+
+	const size_t stride = size_t(bytes_per_row) + 1;
+
+	band._output.resize(deflateBound(&zs, uLong(stride * (band._last - band._first))) + 64);
+	band._adler = 1;
+
+	std::vector<char> filtered(stride);
+	std::vector<char> scratch(bytes_per_row);
+	const std::vector<char> zero_row(bytes_per_row, 0);
+
+	bool ok = true;
+
+	for (int row = band._first; ok && row < band._last; ++row) {
+		const char* current = pixels + size_t(row) * bytes_per_row;
+		const char* previous = row > 0 ? current - bytes_per_row : zero_row.data();
+
+		filtered[0] = char(filter_scanline_adaptive(pass._filter, &filtered[1], scratch.data(), current, previous, bytes_per_row, bytes_per_pixel));
+
+		band._adler = update_adler32(band._adler, filtered.data(), stride);
+
+		zs.next_in = (Bytef*)filtered.data();
+		zs.avail_in = uInt(stride);
+
+		const int flush = row + 1 < band._last ? Z_NO_FLUSH : last ? Z_FINISH : Z_FULL_FLUSH;
+
+		ok = deflate_all(zs, band._output, flush);
+	}
+
+	band._output.resize(zs.total_out);
+
+	deflateEnd(&zs);
+
+	return ok;
+}
+
+// Runs the passes the options ask for and keeps the smallest output
+static bool compress_band_passes(const char* pixels, int bytes_per_row, int bytes_per_pixel, Band& band, const EncodeOptions& options, bool last) {
+	const int passes = std::clamp(options._passes, 1, MAX_PASSES);
+
+	if(!compress_band(pixels, bytes_per_row, bytes_per_pixel, band, options, { options._filter, options._strategy }, last)) {
+		return false;
+	}
+
+	Band attempt { band._first, band._last, {}, 0, false };
+
+	for (int pass = 1; pass < passes; ++pass) {
+		if(!compress_band(pixels, bytes_per_row, bytes_per_pixel, attempt, options, EXTRA_PASSES[pass - 1], last)) {
+			return false;
+		}
+
+		if(attempt._output.size() < band._output.size()) {
+			std::swap(band, attempt);
+		}
+	}
+
+	return true;
+}
+
+bool compress_scanlines(const char* pixels, int bytes_per_row, int bytes_per_pixel, int rows, const EncodeOptions& options, std::vector<char>& stream) {
+	const size_t stride = size_t(bytes_per_row) + 1;
+	const int level = std::clamp(options._level, 0, 9);
+	const int window_bits = std::clamp(options._window_bits, 9, 15);
+	const int threads = options._threads > 0 ? options._threads : hardware_threads();
+
+	const int rows_per_band = int(std::max<size_t>(1, BAND_SIZE / stride));
+	const int band_count = std::max(1, (rows + rows_per_band - 1) / rows_per_band);
+
+	std::vector<Band> bands(band_count);
+	for (int index = 0; index < band_count; ++index) {
+		bands[index]._first = index * rows_per_band;
+		bands[index]._last = std::min(rows, (index + 1) * rows_per_band);
+	}
+
+	std::atomic<int> compressed { 0 };
+
+	run_parallel(threads, band_count, [&](int index) {
+		bands[index]._ok = compress_band_passes(pixels, bytes_per_row, bytes_per_pixel, bands[index], options, index + 1 == band_count);
+
+		report_progress("Compressing", ++compressed, band_count);
+	});
+
+	// zlib header with the window size and the level hint, then the bands back to back and the combined adler32
+	const uint8_t cmf = uint8_t(((window_bits - 8) << 4) | Z_DEFLATED);
+	uint8_t flg = uint8_t((level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6);
+	flg += (31 - (cmf * 256 + flg) % 31) % 31;
+
+	size_t size = 2 + 4;
+	for (auto& band : bands) {
+		if(!band._ok) {
+			return false;
+		}
+		size += band._output.size();
+	}
+
+	stream.clear();
+	stream.reserve(size);
+	stream.push_back(char(cmf));
+	stream.push_back(char(flg));
+
+	uLong adler = adler32(0, Z_NULL, 0);
+
+	for (auto& band : bands) {
+		stream.insert(stream.end(), band._output.begin(), band._output.end());
+		adler = adler32_combine(adler, band._adler, z_off_t(stride * (band._last - band._first)));
+
+		std::vector<char>().swap(band._output);
+	}
+
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		stream.push_back(char(adler >> shift));
+	}
+
+	return true;
+}
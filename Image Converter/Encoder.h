@@ -0,0 +1,34 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <vector>
+#include <cstddef>
+
+#include "Filter.h"
+
+#define MIN_EFFORT 0
+#define MAX_EFFORT 9
+#define DEFAULT_EFFORT 6
+
+struct EncodeOptions {
+	int _level = 6;    // zlib compression level
+	int _threads = 0;  // 0 is one per core
+
+	FilterStrategy _filter = FilterStrategy::MinSum;  // per row filter choice, Entropy trades encode time for size
+
+	int _strategy = 0;      // zlib strategy, Z_DEFAULT_STRATEGY, Z_FILTERED or Z_RLE
+	int _window_bits = 15;  // 9..15, written to the zlib header
+	int _mem_level = 8;     // 1..9, more is faster and bigger
+	int _passes = 1;        // above 1 every band is also compressed with the next alternatives and the smallest is kept
+};
+
+// Presets from 0 (stored, fastest) to 9 (several passes, smallest), out of range values are clamped
+// the numbers behind each step come from Benchmark --encode
+EncodeOptions effort_options(int effort);
+
+// Filters and deflates top down scanlines (bytes_per_row each, back to back) into one zlib stream
+// the rows are cut into fixed size bands that compress on separate threads, every band but the last ends on a Z_FULL_FLUSH
+// so the raw pieces join into a single stream, and the output is the same whatever the thread count
+bool compress_scanlines(const char* pixels, int bytes_per_row, int bytes_per_pixel, int rows, const EncodeOptions& options, std::vector<char>& stream);
+
+#endif
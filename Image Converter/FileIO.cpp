@@ -0,0 +1,424 @@
+#include "FileIO.h"
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(std::string_view file) {
+	close();
+
+	const std::string path(file);
+
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if(handle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	_file = handle;
+
+	LARGE_INTEGER size;
+	if(GetFileType(handle) != FILE_TYPE_DISK || !GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+		close();
+		return false;
+	}
+
+	_mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(!_mapping) {
+		close();
+		return false;
+	}
+
+	_data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+	if(!_data) {
+		close();
+		return false;
+	}
+
+	_size = size_t(size.QuadPart);
+
+	return true;
+}
+
+void MappedFile::close() {
+	if(_data) {
+		UnmapViewOfFile(_data);
+	}
+	if(_mapping) {
+		CloseHandle(_mapping);
+	}
+	if(_file) {
+		CloseHandle(_file);
+	}
+
+	_file = nullptr;
+	_mapping = nullptr;
+	_data = nullptr;
+	_size = 0;
+}
+
+#else
+
+bool MappedFile::open(std::string_view file) {
+	close();
+
+	const std::string path(file);
+
+	_fd = ::open(path.c_str(), O_RDONLY);
+	if(_fd < 0) {
+		return false;
+	}
+
+	struct stat info;
+	if(fstat(_fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+		close();
+		return false;
+	}
+
+	void* data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, _fd, 0);
+	if(data == MAP_FAILED) {
+		close();
+		return false;
+	}
+
+	madvise(data, size_t(info.st_size), MADV_SEQUENTIAL);
+
+	_data = (const char*)data;
+	_size = size_t(info.st_size);
+
+	return true;
+}
+
+void MappedFile::close() {
+	if(_data) {
+		munmap((void*)_data, _size);
+	}
+	if(_fd >= 0) {
+		::close(_fd);
+	}
+
+	_fd = -1;
+	_data = nullptr;
+	_size = 0;
+}
+
+#endif
+
+const char* MappedFile::data() const {
+	return _data;
+}
+
+size_t MappedFile::size() const {
+	return _size;
+}
+
+#ifdef _WIN32
+
+size_t read_file_start(std::string_view file, char* buffer, size_t size) {
+	const std::string path(file);
+
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(handle == INVALID_HANDLE_VALUE) {
+		return 0;
+	}
+
+	DWORD count = 0;
+	if(!ReadFile(handle, buffer, DWORD(size), &count, nullptr)) {
+		count = 0;
+	}
+
+	CloseHandle(handle);
+
+	return size_t(count);
+}
+
+#else
+
+size_t read_file_start(std::string_view file, char* buffer, size_t size) {
+	const std::string path(file);
+
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0) {
+		return 0;
+	}
+
+	const ssize_t count = pread(fd, buffer, size, 0);
+
+	::close(fd);
+
+	return count > 0 ? size_t(count) : 0;
+}
+
+#endif
+
+bool read_whole_file(std::string_view file, std::vector<char>& data) {
+	const bool is_stdin = file == "-";
+
+	FILE* input = nullptr;
+	if(is_stdin) {
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		input = stdin;
+	}
+	else {
+		input = fopen(std::string(file).c_str(), "rb");
+	}
+
+	if(!input) {
+		return false;
+	}
+
+	constexpr size_t block_size = 1 << 16;
+
+	data.clear();
+
+	size_t size = 0;
+	size_t count = 0;
+	do {
+		data.resize(size + block_size);
+		count = fread(&data[size], 1, block_size, input);
+		size += count;
+	} while (count == block_size);
+
+	data.resize(size);
+
+	const bool ok = !ferror(input);
+
+	if(!is_stdin) {
+		fclose(input);
+	}
+
+	return ok;
+}
+
+// *********************************************************************************************************************************************************************************************************************
+
+constexpr size_t DIRECT_ALIGNMENT = 4096;
+constexpr size_t DIRECT_BLOCK_SIZE = 4 << 20;
+
+static size_t total_size(std::initializer_list<WriteBuffer> buffers) {
+	size_t size = 0;
+	for (auto& buffer : buffers) {
+		size += buffer._size;
+	}
+	return size;
+}
+
+// Unbuffered writes need aligned memory, offsets and sizes, so the buffers are copied through one aligned block
+// the last block is padded and the file is cut back to its real size afterwards
+template<typename WriteBlock>
+static bool write_staged(std::initializer_list<WriteBuffer> buffers, WriteBlock write_block) {
+	const size_t size = total_size(buffers);
+	const size_t block_size = std::min(DIRECT_BLOCK_SIZE, (size + DIRECT_ALIGNMENT - 1) & ~(DIRECT_ALIGNMENT - 1));
+
+#ifdef _WIN32
+	char* block = (char*)_aligned_malloc(block_size, DIRECT_ALIGNMENT);
+#else
+	char* block = (char*)aligned_alloc(DIRECT_ALIGNMENT, block_size);
+#endif
+	if(!block) {
+		return false;
+	}
+
+	bool ok = true;
+	size_t filled = 0;
+
+	for (auto& buffer : buffers) {
+		const char* ptr = (const char*)buffer._data;
+		size_t remaining = buffer._size;
+
+		while (ok && remaining > 0) {
+			const size_t count = std::min(remaining, block_size - filled);
+			memcpy(block + filled, ptr, count);
+
+			filled += count;
+			ptr += count;
+			remaining -= count;
+
+			if(filled == block_size) {
+				ok = write_block(block, block_size);
+				filled = 0;
+			}
+		}
+	}
+
+	if(ok && filled > 0) {
+		const size_t padded = (filled + DIRECT_ALIGNMENT - 1) & ~(DIRECT_ALIGNMENT - 1);
+		memset(block + filled, 0, padded - filled);
+		ok = write_block(block, padded);
+	}
+
+#ifdef _WIN32
+	_aligned_free(block);
+#else
+	free(block);
+#endif
+
+	return ok;
+}
+
+#ifdef _WIN32
+
+static bool write_all(HANDLE file, const char* data, size_t size) {
+	while (size > 0) {
+		DWORD written = 0;
+		const DWORD count = DWORD(std::min(size, size_t(1) << 30));
+
+		if(!WriteFile(file, data, count, &written, nullptr) || written == 0) {
+			return false;
+		}
+
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+bool write_file(std::string_view file, std::initializer_list<WriteBuffer> buffers, int flags) {
+	const std::string path(file);
+	const size_t size = total_size(buffers);
+
+	const DWORD attributes = (flags & WRITE_DIRECT) ? FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH : FILE_FLAG_SEQUENTIAL_SCAN;
+
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | attributes, nullptr);
+	if(handle == INVALID_HANDLE_VALUE && (flags & WRITE_DIRECT)) { // not every volume allows unbuffered io
+		flags &= ~WRITE_DIRECT;
+		handle = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	}
+	if(handle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	if(flags & WRITE_PREALLOCATE) {
+		FILE_ALLOCATION_INFO allocation;
+		allocation.AllocationSize.QuadPart = LONGLONG(size);
+		SetFileInformationByHandle(handle, FileAllocationInfo, &allocation, sizeof(allocation));
+	}
+
+	bool ok = true;
+
+	if(flags & WRITE_DIRECT) {
+		ok = write_staged(buffers, [handle](const char* block, size_t count) {
+			return write_all(handle, block, count);
+		});
+
+		if(ok) {
+			LARGE_INTEGER end;
+			end.QuadPart = LONGLONG(size);
+			ok = SetFilePointerEx(handle, end, nullptr, FILE_BEGIN) && SetEndOfFile(handle);
+		}
+	}
+	else {
+		// WriteFileGather only takes page sized, page aligned buffers, so it's one WriteFile per buffer
+		for (auto& buffer : buffers) {
+			ok = ok && write_all(handle, (const char*)buffer._data, buffer._size);
+		}
+	}
+
+	CloseHandle(handle);
+
+	return ok;
+}
+
+#else
+
+static bool write_all(int fd, std::initializer_list<WriteBuffer> buffers) {
+	constexpr int max_buffers = 16;
+
+	iovec vectors[max_buffers];
+	int count = 0;
+
+	for (auto& buffer : buffers) {
+		if(buffer._size > 0 && count < max_buffers) {
+			vectors[count++] = { (void*)buffer._data, buffer._size };
+		}
+	}
+
+	iovec* vector = vectors;
+
+	while (count > 0) {
+		const ssize_t written = writev(fd, vector, count);
+		if(written <= 0) {
+			return false;
+		}
+
+		size_t remaining = size_t(written);
+		while (count > 0 && remaining >= vector->iov_len) { // drop what was fully written, trim a partial one
+			remaining -= vector->iov_len;
+			++vector;
+			--count;
+		}
+		if(count > 0) {
+			vector->iov_base = (char*)vector->iov_base + remaining;
+			vector->iov_len -= remaining;
+		}
+	}
+
+	return true;
+}
+
+bool write_file(std::string_view file, std::initializer_list<WriteBuffer> buffers, int flags) {
+	const std::string path(file);
+	const size_t size = total_size(buffers);
+
+	int fd = -1;
+
+#ifdef O_DIRECT
+	if(flags & WRITE_DIRECT) {
+		fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	}
+#endif
+	if(fd < 0) { // no O_DIRECT here, or the filesystem refused it
+		flags &= ~WRITE_DIRECT;
+		fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if(fd < 0) {
+		return false;
+	}
+
+#ifdef __linux__
+	if((flags & WRITE_PREALLOCATE) && size > 0) {
+		posix_fallocate(fd, 0, off_t(size));
+	}
+#endif
+
+	bool ok = true;
+
+	if(flags & WRITE_DIRECT) {
+		ok = write_staged(buffers, [fd](const char* block, size_t count) {
+			return write_all(fd, { { block, count } });
+		});
+
+		ok = ok && ftruncate(fd, off_t(size)) == 0;
+	}
+	else {
+		ok = write_all(fd, buffers);
+	}
+
+	ok = ::close(fd) == 0 && ok;
+
+	return ok;
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include <vector>
+#include <string_view>
+#include <initializer_list>
+
+// Read-only view of a whole file, mapped straight into the address space so images can be parsed without copying
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(std::string_view file); // fails for pipes, sockets, devices and empty files
+	void close();
+
+	const char* data() const;
+	size_t size() const;
+private:
+#ifdef _WIN32
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#else
+	int _fd = -1;
+#endif
+	const char* _data = nullptr;
+	size_t _size = 0;
+};
+
+// Reads until end of input, works for non-seekable inputs, "-" is stdin
+bool read_whole_file(std::string_view file, std::vector<char>& data);
+
+// Opens file and reads up to size bytes from the start with a single read, returns how many arrived (0 if it can't be opened)
+size_t read_file_start(std::string_view file, char* buffer, size_t size);
+
+struct WriteBuffer {
+	const void* _data;
+	size_t _size;
+};
+
+#define WRITE_PREALLOCATE 1  // reserve the whole file up front so large outputs aren't extended piece by piece
+#define WRITE_DIRECT 2       // bypass the page cache (O_DIRECT / FILE_FLAG_NO_BUFFERING), staged through an aligned block
+
+// Creates or truncates file and writes the buffers back to back, with a single gather call where the OS has one
+bool write_file(std::string_view file, std::initializer_list<WriteBuffer> buffers, int flags = 0);
+
+#endif
@@ -0,0 +1,548 @@
+#include "Filter.h"
+#include "Cpu.h"
+
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+static inline uint8_t paeth_predictor(uint8_t a, uint8_t b, uint8_t c) { // a = left pixel, b = up pixel, c = up left pixel
+	const short p = a + b - c;
+	const short pa = abs(p - a);
+	const short pb = abs(p - b);
+	const short pc = abs(p - c);
+
+	if		(pa <= pb && pa <= pc)   return a;
+	else if (pb <= pc)			     return b;
+	else							 return c;
+}
+
+// One instance per pixel size, the first pixel (no left neighbour) is peeled off so the hot loops don't branch per byte
+template<int bytes_per_pixel>
+static bool unfilter_scanline_fixed(int filter, uint8_t* row, const uint8_t* prev, int bytes_per_row) {
+	constexpr int bpp = bytes_per_pixel;
+
+	switch (filter) {
+	case FILTER_NONE:
+		break;
+	case FILTER_SUB:
+		for (int byte = bpp; byte < bytes_per_row; ++byte) {
+			row[byte] += row[byte - bpp];
+		}
+		break;
+	case FILTER_UP:
+		for (int byte = 0; byte < bytes_per_row; ++byte) {
+			row[byte] += prev[byte];
+		}
+		break;
+	case FILTER_AVERAGE:
+		for (int byte = 0; byte < bpp; ++byte) { // left is zero
+			row[byte] += prev[byte] >> 1;
+		}
+		for (int byte = bpp; byte < bytes_per_row; ++byte) {
+			row[byte] += (row[byte - bpp] + prev[byte]) >> 1;
+		}
+		break;
+	case FILTER_PAETH:
+		for (int byte = 0; byte < bpp; ++byte) { // left and up left are zero, which always predicts up
+			row[byte] += prev[byte];
+		}
+		for (int byte = bpp; byte < bytes_per_row; ++byte) {
+			row[byte] += paeth_predictor(row[byte - bpp], prev[byte], prev[byte - bpp]);
+		}
+		break;
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+bool unfilter_scanline_scalar(int filter, char* row, const char* prev, int bytes_per_row, int bytes_per_pixel) {
+	uint8_t* r = (uint8_t*)row;
+	const uint8_t* p = (const uint8_t*)prev;
+
+	switch (bytes_per_pixel) {
+	case 1: return unfilter_scanline_fixed<1>(filter, r, p, bytes_per_row);  // gray, palette and sub byte depths
+	case 2: return unfilter_scanline_fixed<2>(filter, r, p, bytes_per_row);  // gray + alpha, 16 bit gray
+	case 3: return unfilter_scanline_fixed<3>(filter, r, p, bytes_per_row);  // rgb
+	case 4: return unfilter_scanline_fixed<4>(filter, r, p, bytes_per_row);  // rgba, 16 bit gray + alpha
+	case 6: return unfilter_scanline_fixed<6>(filter, r, p, bytes_per_row);  // 16 bit rgb
+	case 8: return unfilter_scanline_fixed<8>(filter, r, p, bytes_per_row);  // 16 bit rgba
+	default: return false;
+	}
+}
+
+// *********************************************************************************************************************************************************************************************************************
+
+#ifdef CPU_X86
+
+// Sub, Average and Paeth depend on the pixel to the left, so those kernels move one pixel per step with the channels in
+// parallel (bpp 3 and 4 only) while Up has no dependency and runs a whole register at a time
+
+template<int bytes_per_pixel>
+static inline __m128i load_pixel(const char* ptr) {
+	int value = 0;
+	memcpy(&value, ptr, bytes_per_pixel);
+	return _mm_cvtsi32_si128(value);
+}
+
+template<int bytes_per_pixel>
+static inline void store_pixel(char* ptr, __m128i pixel) {
+	const int value = _mm_cvtsi128_si32(pixel);
+	memcpy(ptr, &value, bytes_per_pixel);
+}
+
+static inline __m128i if_then_else(__m128i mask, __m128i a, __m128i b) {
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static void unfilter_sub3_sse2(char* row, int bytes_per_row) {
+	const __m128i low_pixel = _mm_cvtsi32_si128(0x00FFFFFF);
+
+	__m128i carry = _mm_setzero_si128(); // last reconstructed pixel in bytes 0..2
+
+	int i = 0;
+	for (; i + 16 <= bytes_per_row; i += 12) { // prefix sum over 4 pixels, the 4 spare bytes are loaded but not stored
+		__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+
+		x = _mm_add_epi8(x, carry);
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+
+		_mm_storel_epi64((__m128i*)(row + i), x);
+		store_pixel<4>(row + i + 8, _mm_srli_si128(x, 8));
+
+		carry = _mm_and_si128(_mm_srli_si128(x, 9), low_pixel);
+	}
+
+	for (i = i < 3 ? 3 : i; i < bytes_per_row; ++i) {
+		row[i] += row[i - 3];
+	}
+}
+
+static void unfilter_sub4_sse2(char* row, int bytes_per_row) {
+	__m128i carry = _mm_setzero_si128(); // last reconstructed pixel in bytes 0..3
+
+	int i = 0;
+	for (; i + 16 <= bytes_per_row; i += 16) { // prefix sum over 4 pixels
+		__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+
+		x = _mm_add_epi8(x, carry);
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+
+		_mm_storeu_si128((__m128i*)(row + i), x);
+
+		carry = _mm_srli_si128(x, 12);
+	}
+
+	for (i = i < 4 ? 4 : i; i < bytes_per_row; ++i) {
+		row[i] += row[i - 4];
+	}
+}
+
+static void unfilter_up_sse2(char* row, const char* prev, int bytes_per_row) {
+	int i = 0;
+	for (; i + 16 <= bytes_per_row; i += 16) {
+		const __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+		const __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+
+		_mm_storeu_si128((__m128i*)(row + i), _mm_add_epi8(x, b));
+	}
+
+	for (; i < bytes_per_row; ++i) {
+		row[i] += prev[i];
+	}
+}
+
+template<int bytes_per_pixel>
+static void unfilter_average_sse2(char* row, const char* prev, int bytes_per_row) {
+	const __m128i one = _mm_set1_epi8(1);
+
+	__m128i a = _mm_setzero_si128();
+
+	for (int i = 0; i < bytes_per_row; i += bytes_per_pixel) {
+		const __m128i b = load_pixel<bytes_per_pixel>(prev + i);
+		__m128i x = load_pixel<bytes_per_pixel>(row + i);
+
+		// pavgb rounds up, take the carry back off to get (a + b) / 2
+		const __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+
+		x = _mm_add_epi8(x, average);
+		store_pixel<bytes_per_pixel>(row + i, x);
+
+		a = x;
+	}
+}
+
+template<int bytes_per_pixel>
+static void unfilter_paeth_sse2(char* row, const char* prev, int bytes_per_row) {
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128i a = zero; // left, up and up left pixels widened to 16 bits
+	__m128i c = zero;
+
+	for (int i = 0; i < bytes_per_row; i += bytes_per_pixel) {
+		const __m128i b = _mm_unpacklo_epi8(load_pixel<bytes_per_pixel>(prev + i), zero);
+		__m128i x = load_pixel<bytes_per_pixel>(row + i);
+
+		// p = a + b - c, so |p - a| = |b - c|, |p - b| = |a - c| and |p - c| = |(b - c) + (a - c)|
+		__m128i pa = _mm_sub_epi16(b, c);
+		__m128i pb = _mm_sub_epi16(a, c);
+		__m128i pc = _mm_add_epi16(pa, pb);
+
+		pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+		pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+		pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+
+		const __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+		const __m128i nearest = if_then_else(_mm_cmpeq_epi16(pa, smallest), a, if_then_else(_mm_cmpeq_epi16(pb, smallest), b, c));
+
+		x = _mm_add_epi8(x, _mm_packus_epi16(nearest, nearest));
+		store_pixel<bytes_per_pixel>(row + i, x);
+
+		a = _mm_unpacklo_epi8(x, zero);
+		c = b;
+	}
+}
+
+template<int bytes_per_pixel>
+CPU_TARGET("ssse3")
+static void unfilter_paeth_ssse3(char* row, const char* prev, int bytes_per_row) {
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128i a = zero;
+	__m128i c = zero;
+
+	for (int i = 0; i < bytes_per_row; i += bytes_per_pixel) {
+		const __m128i b = _mm_unpacklo_epi8(load_pixel<bytes_per_pixel>(prev + i), zero);
+		__m128i x = load_pixel<bytes_per_pixel>(row + i);
+
+		const __m128i b_minus_c = _mm_sub_epi16(b, c);
+		const __m128i a_minus_c = _mm_sub_epi16(a, c);
+
+		const __m128i pa = _mm_abs_epi16(b_minus_c);
+		const __m128i pb = _mm_abs_epi16(a_minus_c);
+		const __m128i pc = _mm_abs_epi16(_mm_add_epi16(b_minus_c, a_minus_c));
+
+		const __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+		const __m128i nearest = if_then_else(_mm_cmpeq_epi16(pa, smallest), a, if_then_else(_mm_cmpeq_epi16(pb, smallest), b, c));
+
+		x = _mm_add_epi8(x, _mm_packus_epi16(nearest, nearest));
+		store_pixel<bytes_per_pixel>(row + i, x);
+
+		a = _mm_unpacklo_epi8(x, zero);
+		c = b;
+	}
+}
+
+CPU_TARGET("avx2")
+static void unfilter_sub4_avx2(char* row, int bytes_per_row) {
+	const __m256i last_pixel = _mm256_setr_epi32(7, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i low_pixel = _mm256_setr_epi32(-1, 0, 0, 0, 0, 0, 0, 0);
+
+	__m256i carry = _mm256_setzero_si256();
+
+	int i = 0;
+	for (; i + 32 <= bytes_per_row; i += 32) { // prefix sum over 8 pixels, in lane first then low lane into high lane
+		__m256i x = _mm256_loadu_si256((const __m256i*)(row + i));
+
+		x = _mm256_add_epi8(x, carry);
+		x = _mm256_add_epi8(x, _mm256_slli_si256(x, 4));
+		x = _mm256_add_epi8(x, _mm256_slli_si256(x, 8));
+
+		const __m256i lane_totals = _mm256_shuffle_epi32(x, 0xFF);
+		x = _mm256_add_epi8(x, _mm256_permute2x128_si256(lane_totals, lane_totals, 0x08));
+
+		_mm256_storeu_si256((__m256i*)(row + i), x);
+
+		carry = _mm256_and_si256(_mm256_permutevar8x32_epi32(x, last_pixel), low_pixel);
+	}
+
+	for (i = i < 4 ? 4 : i; i < bytes_per_row; ++i) {
+		row[i] += row[i - 4];
+	}
+}
+
+CPU_TARGET("avx2")
+static void unfilter_up_avx2(char* row, const char* prev, int bytes_per_row) {
+	int i = 0;
+	for (; i + 32 <= bytes_per_row; i += 32) {
+		const __m256i x = _mm256_loadu_si256((const __m256i*)(row + i));
+		const __m256i b = _mm256_loadu_si256((const __m256i*)(prev + i));
+
+		_mm256_storeu_si256((__m256i*)(row + i), _mm256_add_epi8(x, b));
+	}
+
+	for (; i < bytes_per_row; ++i) {
+		row[i] += prev[i];
+	}
+}
+
+struct FilterKernelSet {
+	void (*_sub3)(char* row, int bytes_per_row);
+	void (*_sub4)(char* row, int bytes_per_row);
+	void (*_up)(char* row, const char* prev, int bytes_per_row);
+	void (*_average3)(char* row, const char* prev, int bytes_per_row);
+	void (*_average4)(char* row, const char* prev, int bytes_per_row);
+	void (*_paeth3)(char* row, const char* prev, int bytes_per_row);
+	void (*_paeth4)(char* row, const char* prev, int bytes_per_row);
+};
+
+// Average and Paeth are bound by the left pixel dependency, wider registers don't help them so AVX2 keeps the 128 bit versions
+constexpr FilterKernelSet SSE2_KERNELS = {
+	unfilter_sub3_sse2, unfilter_sub4_sse2, unfilter_up_sse2,
+	unfilter_average_sse2<3>, unfilter_average_sse2<4>, unfilter_paeth_sse2<3>, unfilter_paeth_sse2<4>
+};
+constexpr FilterKernelSet SSSE3_KERNELS = {
+	unfilter_sub3_sse2, unfilter_sub4_sse2, unfilter_up_sse2,
+	unfilter_average_sse2<3>, unfilter_average_sse2<4>, unfilter_paeth_ssse3<3>, unfilter_paeth_ssse3<4>
+};
+constexpr FilterKernelSet AVX2_KERNELS = {
+	unfilter_sub3_sse2, unfilter_sub4_avx2, unfilter_up_avx2,
+	unfilter_average_sse2<3>, unfilter_average_sse2<4>, unfilter_paeth_ssse3<3>, unfilter_paeth_ssse3<4>
+};
+
+static bool unfilter_scanline_simd(const FilterKernelSet& kernels, int filter, char* row, const char* prev, int bytes_per_row, int bytes_per_pixel) {
+	if(filter == FILTER_UP) {
+		kernels._up(row, prev, bytes_per_row);
+		return true;
+	}
+
+	if(bytes_per_pixel == 3) {
+		switch (filter) {
+		case FILTER_SUB:		kernels._sub3(row, bytes_per_row);				return true;
+		case FILTER_AVERAGE:	kernels._average3(row, prev, bytes_per_row);	return true;
+		case FILTER_PAETH:		kernels._paeth3(row, prev, bytes_per_row);		return true;
+		}
+	}
+	else if(bytes_per_pixel == 4) {
+		switch (filter) {
+		case FILTER_SUB:		kernels._sub4(row, bytes_per_row);				return true;
+		case FILTER_AVERAGE:	kernels._average4(row, prev, bytes_per_row);	return true;
+		case FILTER_PAETH:		kernels._paeth4(row, prev, bytes_per_row);		return true;
+		}
+	}
+
+	return unfilter_scanline_scalar(filter, row, prev, bytes_per_row, bytes_per_pixel);
+}
+
+#endif
+
+static FilterKernels best_filter_kernels() {
+	const auto& cpu = cpu_features();
+
+	if(cpu._avx2)	return FilterKernels::AVX2;
+	if(cpu._ssse3)	return FilterKernels::SSSE3;
+	if(cpu._sse2)	return FilterKernels::SSE2;
+
+	return FilterKernels::Scalar;
+}
+
+static std::atomic<FilterKernels> active_filter_kernels{ best_filter_kernels() };
+
+bool unfilter_scanline(int filter, char* row, const char* prev, int bytes_per_row, int bytes_per_pixel) {
+#ifdef CPU_X86
+	switch (active_filter_kernels.load(std::memory_order_relaxed)) {
+	case FilterKernels::AVX2:	return unfilter_scanline_simd(AVX2_KERNELS, filter, row, prev, bytes_per_row, bytes_per_pixel);
+	case FilterKernels::SSSE3:	return unfilter_scanline_simd(SSSE3_KERNELS, filter, row, prev, bytes_per_row, bytes_per_pixel);
+	case FilterKernels::SSE2:	return unfilter_scanline_simd(SSE2_KERNELS, filter, row, prev, bytes_per_row, bytes_per_pixel);
+	case FilterKernels::Scalar:	break;
+	}
+#endif
+
+	return unfilter_scanline_scalar(filter, row, prev, bytes_per_row, bytes_per_pixel);
+}
+
+FilterKernels set_filter_kernels(FilterKernels kernels) {
+	const FilterKernels best = best_filter_kernels();
+
+	active_filter_kernels = int(kernels) > int(best) ? best : kernels;
+
+	return active_filter_kernels;
+}
+
+FilterKernels filter_kernels() {
+	return active_filter_kernels;
+}
+
+// *********************************************************************************************************************************************************************************************************************
+
+// Encoding has no dependency between outputs, plain loops vectorize as they are
+void filter_scanline(int filter, char* out, const char* row, const char* prev, int bytes_per_row, int bytes_per_pixel) {
+	uint8_t* o = (uint8_t*)out;
+	const uint8_t* r = (const uint8_t*)row;
+	const uint8_t* p = (const uint8_t*)prev;
+	const int bpp = std::min(bytes_per_pixel, bytes_per_row);
+
+	switch (filter) {
+	case FILTER_SUB:
+		memcpy(o, r, bpp);
+		for (int byte = bpp; byte < bytes_per_row; ++byte) {
+			o[byte] = r[byte] - r[byte - bpp];
+		}
+		break;
+	case FILTER_UP:
+		for (int byte = 0; byte < bytes_per_row; ++byte) {
+			o[byte] = r[byte] - p[byte];
+		}
+		break;
+	case FILTER_AVERAGE:
+		for (int byte = 0; byte < bpp; ++byte) {
+			o[byte] = r[byte] - (p[byte] >> 1);
+		}
+		for (int byte = bpp; byte < bytes_per_row; ++byte) {
+			o[byte] = r[byte] - ((r[byte - bpp] + p[byte]) >> 1);
+		}
+		break;
+	case FILTER_PAETH:
+		for (int byte = 0; byte < bpp; ++byte) {
+			o[byte] = r[byte] - p[byte];
+		}
+		for (int byte = bpp; byte < bytes_per_row; ++byte) {
+			o[byte] = r[byte] - paeth_predictor(r[byte - bpp], p[byte], p[byte - bpp]);
+		}
+		break;
+	default:
+		memcpy(o, r, bytes_per_row);
+		break;
+	}
+}
+
+// *********************************************************************************************************************************************************************************************************************
+
+// Sum of |byte| with the bytes taken as signed, min(x, -x) as unsigned is that absolute value and psadbw adds 8 of them at a time
+
+static size_t sum_abs_scalar(const uint8_t* data, int size) {
+	size_t sum = 0;
+
+	for (int i = 0; i < size; ++i) {
+		sum += data[i] < 128 ? data[i] : 256 - data[i];
+	}
+
+	return sum;
+}
+
+#ifdef CPU_X86
+
+CPU_TARGET("sse2")
+static size_t sum_abs_sse2(const uint8_t* data, int size) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i total = zero;
+
+	int i = 0;
+	for (; i + 16 <= size; i += 16) {
+		const __m128i x = _mm_loadu_si128((const __m128i*)(data + i));
+		const __m128i a = _mm_min_epu8(x, _mm_sub_epi8(zero, x));
+
+		total = _mm_add_epi64(total, _mm_sad_epu8(a, zero));
+	}
+
+	uint64_t lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, total);
+
+	return size_t(lanes[0] + lanes[1]) + sum_abs_scalar(data + i, size - i);
+}
+
+CPU_TARGET("avx2")
+static size_t sum_abs_avx2(const uint8_t* data, int size) {
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i total = zero;
+
+	int i = 0;
+	for (; i + 32 <= size; i += 32) {
+		const __m256i x = _mm256_loadu_si256((const __m256i*)(data + i));
+		const __m256i a = _mm256_min_epu8(x, _mm256_sub_epi8(zero, x));
+
+		total = _mm256_add_epi64(total, _mm256_sad_epu8(a, zero));
+	}
+
+	uint64_t lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, total);
+
+	return size_t(lanes[0] + lanes[1] + lanes[2] + lanes[3]) + sum_abs_scalar(data + i, size - i);
+}
+
+#endif
+
+static size_t sum_abs(const uint8_t* data, int size) {
+#ifdef CPU_X86
+	switch (active_filter_kernels.load(std::memory_order_relaxed)) {
+	case FilterKernels::AVX2:	return sum_abs_avx2(data, size);
+	case FilterKernels::SSSE3:
+	case FilterKernels::SSE2:	return sum_abs_sse2(data, size);
+	case FilterKernels::Scalar:	break;
+	}
+#endif
+
+	return sum_abs_scalar(data, size);
+}
+
+// Order 0 entropy of the bytes in bits, n log2 n - sum c log2 c
+// four interleaved histograms keep consecutive equal bytes from stalling on the same counter
+static double entropy_bits(const uint8_t* data, int size) {
+	uint32_t counts[4][256] = { { 0 } };
+
+	int i = 0;
+	for (; i + 4 <= size; i += 4) {
+		++counts[0][data[i]];
+		++counts[1][data[i + 1]];
+		++counts[2][data[i + 2]];
+		++counts[3][data[i + 3]];
+	}
+	for (; i < size; ++i) {
+		++counts[0][data[i]];
+	}
+
+	double bits = size > 0 ? size * std::log2(double(size)) : 0.0;
+
+	for (int symbol = 0; symbol < 256; ++symbol) {
+		const uint32_t count = counts[0][symbol] + counts[1][symbol] + counts[2][symbol] + counts[3][symbol];
+
+		if(count > 1) {
+			bits -= count * std::log2(double(count));
+		}
+	}
+
+	return bits;
+}
+
+int filter_scanline_adaptive(FilterStrategy strategy, char* out, char* scratch, const char* row, const char* prev, int bytes_per_row, int bytes_per_pixel) {
+	if(strategy != FilterStrategy::MinSum && strategy != FilterStrategy::Entropy) {
+		filter_scanline(int(strategy), out, row, prev, bytes_per_row, bytes_per_pixel);
+		return int(strategy);
+	}
+
+	// The best candidate so far stays in one buffer while the next filter is tried in the other
+	char* best = out;
+	char* candidate = scratch;
+
+	int best_filter = FILTER_NONE;
+	double best_cost = HUGE_VAL;
+
+	for (int filter = FILTER_NONE; filter <= FILTER_PAETH; ++filter) {
+		filter_scanline(filter, candidate, row, prev, bytes_per_row, bytes_per_pixel);
+
+		const uint8_t* data = (const uint8_t*)candidate;
+		const double cost = strategy == FilterStrategy::MinSum ? double(sum_abs(data, bytes_per_row)) : entropy_bits(data, bytes_per_row);
+
+		if(cost < best_cost) {
+			best_cost = cost;
+			best_filter = filter;
+			std::swap(best, candidate);
+		}
+	}
+
+	if(best != out) {
+		memcpy(out, best, bytes_per_row);
+	}
+
+	return best_filter;
+}
@@ -0,0 +1,37 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+// PNG scanline filter types
+#define FILTER_NONE 0
+#define FILTER_SUB 1
+#define FILTER_UP 2
+#define FILTER_AVERAGE 3
+#define FILTER_PAETH 4
+
+// How the encoder picks each scanline's filter, the fixed ones use the matching filter type for every row
+// MinSum keeps the filter whose output has the smallest sum of absolute values (bytes taken as signed)
+// Entropy tries all five and keeps the one with the smallest estimated entropy coded size, slower but usually smaller
+enum class FilterStrategy { None = FILTER_NONE, Sub = FILTER_SUB, Up = FILTER_UP, Average = FILTER_AVERAGE, Paeth = FILTER_PAETH, MinSum, Entropy };
+
+// Instruction sets the defilter kernels can use, the best one the cpu supports is picked at startup
+enum class FilterKernels { Scalar, SSE2, SSSE3, AVX2 };
+
+// Reverses the filter of one scanline in place, prev is the previous reconstructed scanline (all zero for the first row)
+// returns false for an unknown filter type
+bool unfilter_scanline(int filter, char* row, const char* prev, int bytes_per_row, int bytes_per_pixel);
+
+// Plain C++ version, every kernel set must give bit identical results to this
+bool unfilter_scanline_scalar(int filter, char* row, const char* prev, int bytes_per_row, int bytes_per_pixel);
+
+// Applies a filter for encoding, out gets the filtered bytes (without the filter type byte)
+// prev is the previous unfiltered scanline, all zero for the first row
+void filter_scanline(int filter, char* out, const char* row, const char* prev, int bytes_per_row, int bytes_per_pixel);
+
+// Filters with whatever filter the strategy picks and returns its type, out and scratch both need bytes_per_row bytes
+int filter_scanline_adaptive(FilterStrategy strategy, char* out, char* scratch, const char* row, const char* prev, int bytes_per_row, int bytes_per_pixel);
+
+// Overrides the dispatch, requests beyond what the cpu supports fall back to the best supported set
+FilterKernels set_filter_kernels(FilterKernels kernels);
+FilterKernels filter_kernels();
+
+#endif
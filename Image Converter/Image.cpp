@@ -1,12 +1,13 @@
 #include "Image.h"
+#include "FileIO.h"
+#include "Decoder.h"
+#include "Checksum.h"
+#include "Progress.h"
 
-#include <fstream>
 #include <cassert>
 #include <iomanip>
 #include <iostream>
-#include <filesystem>
-
-#include <zlib.h>
+#include <algorithm>
 
 #define HI_NIBBLE(byte) (((byte) >> 4) & 0x0F)
 #define LOW_NIBBLE(byte) ((byte) & 0x0F)
@@ -21,31 +22,27 @@ void fmt_out(std::string_view str1, T val) {
 	std::cout << std::setw(30) << std::left << str1 << std::setw(30) << std::left << val << '\n';
 }
 
-void print_status(std::string_view process, int a, int b) {
-	std::cout << std::setw(30) << std::left << process << " (" << (float(a) / float(b)) * 100.0f << "%) \n";
-}
-
-char* read_bytes(char* ptr, char* data) {
+const char* read_bytes(const char* ptr, char* data) {
 	memcpy(data, ptr, sizeof(char));
 	return ptr + sizeof(char);
 }
 
-char* read_bytes(char* ptr, short* data) {
+const char* read_bytes(const char* ptr, short* data) {
 	memcpy(data, ptr, sizeof(short));
 	return ptr + sizeof(short);
 }
 
-char* read_bytes(char* ptr, int* data) {
+const char* read_bytes(const char* ptr, int* data) {
 	memcpy(data, ptr, sizeof(int));
 	return ptr + sizeof(int);
 }
 
-char* read_bytes(char* ptr, unsigned int* data) {
+const char* read_bytes(const char* ptr, unsigned int* data) {
 	memcpy(data, ptr, sizeof(unsigned int));
 	return ptr + sizeof(unsigned int);
 }
 
-char* read_bytes(char* ptr, long long* data) {
+const char* read_bytes(const char* ptr, long long* data) {
 	memcpy(data, ptr, sizeof(long long));
 	return ptr + sizeof(long long);
 }
@@ -54,30 +51,66 @@ std::string change_ext(std::string file, std::string_view ext) {
 	return file.substr(0, file.find('.') + 1) + ext.data();
 }
 
-std::vector<char> flip_scanlines(std::vector<char> pixels, int bytes_per_pixel, int image_width) {
-	const int bytes_per_row = bytes_per_pixel * image_width;
-	int i = 0;
-	int j = pixels.size() - bytes_per_row;
-
-	std::vector<char> new_pixels;
-	new_pixels.resize(pixels.size());
+std::string read_file_extension(std::string_view file) {
+	return std::string(file.substr(file.find('.') + 1));
+}
 
-	while (j >= 0) {
-		memcpy(&new_pixels[i], &pixels[j], bytes_per_row);
+// Falls back to the file signature for pipes and files without a usable extension
+std::string sniff_file_type(std::string_view ext, const char* data, size_t size) {
+	if(ext == "bmp" || ext == "png") {
+		return std::string(ext);
+	}
 
-		j -= bytes_per_row;
-		i += bytes_per_row;
+	if(size >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0) {
+		return "png";
 	}
 
-	return new_pixels;
-}
+	if(size >= 2 && data[0] == 'B' && data[1] == 'M') {
+		return "bmp";
+	}
 
-std::string read_file_extension(std::string_view file) {
-	return file.substr(file.find('.') + 1).data();
+	return std::string(ext);
 }
 
 ImageReader::ImageReader(std::string_view file) {
-	auto ext = read_file_extension(file);
+	auto mapping = std::make_shared<MappedFile>();
+	std::vector<char> data;
+
+	if(!mapping->open(file)) {
+		mapping.reset();
+
+		if(read_file_extension(file) == "png") { // decode as the bytes arrive instead of buffering the whole pipe
+			auto png = std::make_unique<PNG>();
+
+			std::FILE* input = fopen(std::string(file).c_str(), "rb");
+			const bool ok = input && decode_png(input, *png);
+
+			if(input) {
+				fclose(input);
+			}
+
+			if(!ok) {
+				std::cout << "Unable to read file" << '\n';
+				return;
+			}
+
+			png->_file = file;
+			png->_file_type = "png";
+
+			_image = std::move(png);
+			return;
+		}
+
+		if(!read_whole_file(file, data)) {
+			std::cout << "Unable to read file" << '\n';
+			return;
+		}
+	}
+
+	const char* input = mapping ? mapping->data() : data.data();
+	const size_t input_size = mapping ? mapping->size() : data.size();
+
+	auto ext = sniff_file_type(read_file_extension(file), input, input_size);
 
 	if(ext == "bmp") {
 		_image = std::make_unique<BMP>();
@@ -90,25 +123,18 @@ ImageReader::ImageReader(std::string_view file) {
 		return;
 	}
 
-	std::ifstream image_file(file.data(), std::ios::binary);
-
-	if(!image_file) {
+	if(input_size < 8) {
 		std::cout << "Unable to read file" << '\n';
 		return;
 	}
 
-	image_file.seekg(0, image_file.end);
-	int length = image_file.tellg();
-	image_file.seekg(0, image_file.beg);
-
-	_image->get_data()->resize(length);
-
-	image_file.read(&(*_image->get_data())[0], length);
+	_image->_mapping = std::move(mapping);
+	_image->_data = std::move(data);
 
 	_image->_file = file;
 	_image->_file_type = ext;
 
-	_image->_file_size = std::filesystem::file_size(file);
+	_image->_file_size = int(input_size);
 
 	_image->read();
 }
@@ -117,10 +143,27 @@ Image* ImageReader::image() {
 	return _image.get();
 }
 
+std::unique_ptr<Image> ImageReader::release() {
+	return std::move(_image);
+}
+
 std::vector<char> *Image::get_data() {
 	return &_data;
 }
 
+const char* Image::input() const {
+	return _mapping ? _mapping->data() : _data.data();
+}
+
+size_t Image::input_size() const {
+	return _mapping ? _mapping->size() : _data.size();
+}
+
+void Image::release_input() {
+	_mapping.reset();
+	std::vector<char>().swap(_data);
+}
+
 // *********************************************************************************************************************************************************************************************************************
 
 BMP::BMP() :
@@ -142,10 +185,17 @@ BMP::BMP() :
 {}
 
 void BMP::read() {
-	char* ptr = &_data[0];
+	const char* start_ptr = input();
+	const char* ptr = start_ptr;
+	const size_t size = input_size();
+
+	report_progress("Reading BMP File", 0, 100);
+
+	if(size < 54) {
+		std::cout << "Truncated BMP header" << '\n';
+		return;
+	}
 
-	print_status("Reading BMP File", 0, _file_size);
-	
 	ptr = read_bytes(ptr, &_signature);
 	ptr = read_bytes(ptr, &_file_size);
 	ptr = read_bytes(ptr, &_reserved);
@@ -162,53 +212,119 @@ void BMP::read() {
 	ptr = read_bytes(ptr, &_colors_used);
 	ptr = read_bytes(ptr, &_important_colors);
 
-	print_status("Reading BMP File", _size, _file_size);
+	// BI_BITFIELDS masks follow a 40 byte header and sit inside the newer ones, either way they start here
+	if((_compression == 3 || _compression == 6) && size >= 70) {
+		ptr = read_bytes(ptr, &_bit_masks._red);
+		ptr = read_bytes(ptr, &_bit_masks._green);
+		ptr = read_bytes(ptr, &_bit_masks._blue);
+		ptr = read_bytes(ptr, &_bit_masks._alpha);
 
-	_pixel_data.resize(_size);
-	std::copy(ptr, ptr + _size, _pixel_data.begin());
+		if(_size < 56 && _compression != 6) { // no alpha mask in BITMAPINFOHEADER + 3 masks
+			_bit_masks._alpha = 0;
+		}
+	}
+	else { // BI_RGB, blue green red from the lowest byte up
+		_bit_masks = { 0x00ff0000, 0x0000ff00, 0x000000ff, 0 };
+	}
 
-	print_status("Reading BMP File", 100, 100);
+	if(_size >= 108 && size >= 14 + 108) {
+		ptr = start_ptr + 70;
+		ptr = read_bytes(ptr, &_lcs_windows_color_space);
+		memcpy(_ciexyz_endpoints, ptr, sizeof(_ciexyz_endpoints));
+		ptr += sizeof(_ciexyz_endpoints);
+		ptr = read_bytes(ptr, &_red_gamma);
+		ptr = read_bytes(ptr, &_green_gamma);
+		ptr = read_bytes(ptr, &_blue_gamma);
+	}
+
+	if((_bits_per_pixel != 24 && _bits_per_pixel != 32) || (_compression != 0 && _compression != 3 && _compression != 6)) {
+		std::cout << "Only uncompressed 24 and 32 bit BMPs are supported" << '\n';
+		return;
+	}
+
+	// rows are padded to 4 bytes, image_size is allowed to be 0 for BI_RGB so it's worked out rather than trusted
+	const int64_t stride = ((int64_t(_width) * _bits_per_pixel + 31) / 32) * 4;
+	const int64_t pixel_bytes = stride * std::abs(int64_t(_height));
+
+	if(_width <= 0 || _height == 0 || _data_offset < 0 || int64_t(_data_offset) + pixel_bytes > int64_t(size)) {
+		std::cout << "Truncated BMP pixel data" << '\n';
+		return;
+	}
+
+	_image_size = int(pixel_bytes);
+
+	_pixel_data.resize(size_t(pixel_bytes));
+	std::copy(start_ptr + _data_offset, start_ptr + _data_offset + pixel_bytes, _pixel_data.begin());
+
+	report_progress("Reading BMP File", 100, 100);
+}
+
+template<typename T>
+char* write_bytes(char* ptr, const T& data) {
+	memcpy(ptr, &data, sizeof(T));
+	return ptr + sizeof(T);
+}
+
+size_t BMP::write_header(char* ptr) const {
+	char* start_ptr = ptr;
+
+	ptr = write_bytes(ptr, _signature);
+	ptr = write_bytes(ptr, _file_size);
+	ptr = write_bytes(ptr, _reserved);
+	ptr = write_bytes(ptr, _data_offset);
+
+	ptr = write_bytes(ptr, _size);
+	ptr = write_bytes(ptr, _width);
+	ptr = write_bytes(ptr, _height);
+	ptr = write_bytes(ptr, _planes);
+	ptr = write_bytes(ptr, _bits_per_pixel);
+	ptr = write_bytes(ptr, _compression);
+	ptr = write_bytes(ptr, _image_size);
+	ptr = write_bytes(ptr, _x_pixels_per_m);
+	ptr = write_bytes(ptr, _y_pixels_per_m);
+	ptr = write_bytes(ptr, _colors_used);
+	ptr = write_bytes(ptr, _important_colors);
+	ptr = write_bytes(ptr, _bit_masks._red);
+	ptr = write_bytes(ptr, _bit_masks._green);
+	ptr = write_bytes(ptr, _bit_masks._blue);
+	ptr = write_bytes(ptr, _bit_masks._alpha);
+	ptr = write_bytes(ptr, _lcs_windows_color_space);
+	ptr = write_bytes(ptr, _ciexyz_endpoints);
+	ptr = write_bytes(ptr, _red_gamma);
+	ptr = write_bytes(ptr, _green_gamma);
+	ptr = write_bytes(ptr, _blue_gamma);
+
+	return ptr - start_ptr;
 }
 
 void BMP::save(const char* name) {
+	save(name, 0);
+}
+
+bool BMP::save(const char* name, int write_flags) {
 	std::string path = name;
 	path.append(".bmp");
 
-	std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+	report_progress("Saving BMP File", 0, 100);
 
-	print_status("Saving BMP File", 0, 100);
+	if(_image_size <= 0 || _pixel_data.size() < size_t(_image_size)) {
+		std::cout << "No pixel data to save" << '\n';
+		return false;
+	}
 
-	file.write((char*)&_signature, sizeof(_signature));
-	file.write((char*)&_file_size, sizeof(_file_size));
-	file.write((char*)&_reserved, sizeof(_reserved));
-	file.write((char*)&_data_offset, sizeof(_data_offset));
+	char header[BMP_HEADER_SIZE];
+	const size_t header_size = write_header(header);
 
-	file.write((char*)&_size, sizeof(_size));
-	file.write((char*)&_width, sizeof(_width));
-	file.write((char*)&_height, sizeof(_height));
-	file.write((char*)&_planes, sizeof(_planes));
-	file.write((char*)&_bits_per_pixel, sizeof(_bits_per_pixel));
-	file.write((char*)&_compression, sizeof(_compression));
-	file.write((char*)&_image_size, sizeof(_image_size));
-	file.write((char*)&_x_pixels_per_m, sizeof(_x_pixels_per_m));
-	file.write((char*)&_y_pixels_per_m, sizeof(_y_pixels_per_m));
-	file.write((char*)&_colors_used, sizeof(_colors_used));
-	file.write((char*)&_important_colors, sizeof(_important_colors));
-	file.write((char*)&_bit_masks._red, sizeof(_bit_masks._red));
-	file.write((char*)&_bit_masks._green, sizeof(_bit_masks._green));
-	file.write((char*)&_bit_masks._blue, sizeof(_bit_masks._blue));
-	file.write((char*)&_bit_masks._alpha, sizeof(_bit_masks._alpha));
-	file.write((char*)&_lcs_windows_color_space, sizeof(_lcs_windows_color_space));
-	file.write((char*)&_ciexyz_endpoints, 36);
-	file.write((char*)&_red_gamma, sizeof(_red_gamma));
-	file.write((char*)&_green_gamma, sizeof(_green_gamma));
-	file.write((char*)&_blue_gamma, sizeof(_blue_gamma));
+	// header and pixels go out together in one gather write
+	const bool ok = write_file(path, { { header, header_size }, { _pixel_data.data(), size_t(_image_size) } }, write_flags);
 
-	print_status("Saving BMP File", _size, _file_size);
+	if(!ok) {
+		std::cout << "Unable to write file" << '\n';
+	}
 
-	file.write(&_pixel_data[0], _image_size);
+	report_progress("Saving BMP File", 100, 100);
 
-	print_status("Saving BMP File", 100, 100);
+	return ok;
 }
 
 void BMP::print_info() {
@@ -227,18 +343,162 @@ int BMP::get_type() {
 	return TYPE_BMP;
 }
 
-BMP BMP::to_bmp() {
+BMP BMP::to_bmp() & {
 	return *this;
 }
 
-PNG BMP::to_png() {
+BMP BMP::to_bmp() && {
+	return std::move(*this);
+}
+
+// Shift of an 8 bit wide mask, -1 for anything else
+static int channel_shift(unsigned int mask) {
+	for (int shift = 0; shift <= 24; ++shift) {
+		if(mask == 0xffu << shift) {
+			return shift;
+		}
+	}
+	return -1;
+}
+
+PNG BMP::png_header() const {
 	PNG png;
 
+	png._file = _file;
+	png._file_type = "png";
+	png._file_size = -1;
+
+	memcpy(png._ihdr_chunk._type, "IHDR", 4);
+	png._ihdr_chunk._length = 13;
+	png._ihdr_chunk._width = _width;
+	png._ihdr_chunk._height = std::abs(_height);
+	png._ihdr_chunk._bit_depth = 8;
+	png._ihdr_chunk._color_type = _bits_per_pixel == 32 && _bit_masks._alpha ? 6 : 2;  // rgba : rgb
+	png._ihdr_chunk._compression = 0;
+	png._ihdr_chunk._filter = 0;
+	png._ihdr_chunk._interlace = 0;
+
+	if(_x_pixels_per_m > 0 && _y_pixels_per_m > 0) {
+		png._phys_chunk.emplace();
+		memcpy(png._phys_chunk->_type, "pHYs", 4);
+		png._phys_chunk->_length = 9;
+		png._phys_chunk->_pixels_per_unit_x = _x_pixels_per_m;
+		png._phys_chunk->_pixels_per_unit_y = _y_pixels_per_m;
+		png._phys_chunk->_unit_specifier = 1; // meters
+	}
+
+	return png;
+}
+
+// 32 bit with the masks PNG::to_bmp writes, each row already is a PNG scanline
+bool BMP::has_png_layout() const {
+	return _bits_per_pixel == 32 && _bit_masks._red == Bytes12 && _bit_masks._green == Bytes34 &&
+		   _bit_masks._blue == Bytes56 && _bit_masks._alpha == Bytes78;
+}
+
+// Top down PNG scanlines, 8 bits per channel, alpha only when the BMP has an alpha mask
+bool BMP::unpack_rows(std::vector<char>& pixels) const {
+	const int red = channel_shift(_bit_masks._red);
+	const int green = channel_shift(_bit_masks._green);
+	const int blue = channel_shift(_bit_masks._blue);
+	const int alpha = _bit_masks._alpha ? channel_shift(_bit_masks._alpha) : 0;
+
+	if(red < 0 || green < 0 || blue < 0 || alpha < 0) {
+		std::cout << "Only 8 bit BMP channel masks are supported" << '\n';
+		return false;
+	}
+
+	const int height = std::abs(_height);
+	const int bytes_per_pixel = _bits_per_pixel / 8;
+	const int channels = _bits_per_pixel == 32 && _bit_masks._alpha ? 4 : 3;
+	const size_t stride = ((size_t(_width) * _bits_per_pixel + 31) / 32) * 4;
+	const size_t bytes_per_row = size_t(_width) * channels;
+
+	if(_pixel_data.size() < stride * height) {
+		return false;
+	}
+
+	pixels.resize(bytes_per_row * height);
+
+	for (int row = 0; row < height; ++row) {
+		const char* in = &_pixel_data[(_height > 0 ? height - 1 - row : row) * stride];  // positive heights are bottom up
+		char* out = &pixels[row * bytes_per_row];
+
+		if(has_png_layout()) {
+			memcpy(out, in, bytes_per_row);
+			continue;
+		}
+
+		for (int x = 0; x < _width; ++x, in += bytes_per_pixel, out += channels) {
+			uint32_t value = 0;
+			memcpy(&value, in, bytes_per_pixel);
+
+			out[0] = char(value >> red);
+			out[1] = char(value >> green);
+			out[2] = char(value >> blue);
+			if(channels == 4) {
+				out[3] = char(value >> alpha);
+			}
+		}
+	}
+
+	return true;
+}
+
+PNG BMP::to_png() & {
+	PNG png = png_header();
+
+	report_progress("Converting to PNG", 0, 100);
+
+	unpack_rows(png._pixels);
+
+	report_progress("Converting to PNG", 100, 100);
+
+	return png;
+}
+
+PNG BMP::to_png() && {
+	PNG png = png_header();
+
+	report_progress("Converting to PNG", 0, 100);
+
+	const size_t bytes_per_row = size_t(_width) * 4;
+	const int height = std::abs(_height);
+
+	if(has_png_layout() && _pixel_data.size() >= bytes_per_row * height) {
+		// same bytes as a PNG scanline, flip bottom up rows in place and take the buffer
+		if(_height > 0) {
+			std::vector<char> row(bytes_per_row);
+
+			for (int top = 0, bottom = height - 1; top < bottom; ++top, --bottom) {
+				char* top_row = &_pixel_data[top * bytes_per_row];
+				char* bottom_row = &_pixel_data[bottom * bytes_per_row];
+
+				memcpy(row.data(), top_row, bytes_per_row);
+				memcpy(top_row, bottom_row, bytes_per_row);
+				memcpy(bottom_row, row.data(), bytes_per_row);
+			}
+		}
+
+		_pixel_data.resize(bytes_per_row * height);
+		png._pixels = std::move(_pixel_data);
+	}
+	else {
+		unpack_rows(png._pixels);
+	}
+
+	std::vector<char>().swap(_pixel_data);
+	release_input();
+
+	report_progress("Converting to PNG", 100, 100);
+
 	return png;
 }
 
 // *********************************************************************************************************************************************************************************************************************
 
+constexpr char PNG_SIGNATURE[8] = { '\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n' };
+
 constexpr char IHDR_CHUNK[4] = { 'I', 'H', 'D', 'R' };
 constexpr char IDAT_CHUNK[4] = { 'I', 'D', 'A', 'T' };
 constexpr char IEND_CHUNK[4] = { 'I', 'E', 'N', 'D' };
@@ -250,7 +510,7 @@ constexpr char zTXt_CHUNK[4] = { 'z', 'T', 'X', 't' };
 constexpr char iTXt_CHUNK[4] = { 'i', 'T', 'X', 't' };
 constexpr char cHRM_CHUNK[4] = { 'c', 'H', 'R', 'M' };
 
-bool compare_chunk_type (char* chunk1, const char* chunk2) {
+bool compare_chunk_type (const char* chunk1, const char* chunk2) {
 	for (int i = 0; i < 4; ++i) {
 		if (chunk1[i] != chunk2[i]) {
 			return false;
@@ -259,14 +519,33 @@ bool compare_chunk_type (char* chunk1, const char* chunk2) {
 	return true;
 }
 
+static bool is_critical_chunk(const char* type) { // ancillary chunks start with a lowercase letter
+	return (type[0] & 0x20) == 0;
+}
+
+// ptr is the chunk type, followed by the data and the crc, chunks the checksum policy leaves out always pass
+static bool chunk_crc_ok(const char* ptr, int chunk_length) {
+	if(!verify_chunk_crc(ptr)) {
+		return true;
+	}
+
+	unsigned int crc = 0;
+	read_bytes(ptr + 4 + chunk_length, &crc);
+
+	return update_crc32(0, ptr, size_t(chunk_length) + 4) == (unsigned int)_byteswap_ulong(crc);
+}
+
 PNG::PNG() :
-	_signature ( 727905341920923785 )
+	_signature		( 727905341920923785 ),
+	_ihdr_chunk		( ),
+	_idat_chunk		( )
 {}
 
 void PNG::read() {
-	char* ptr = &_data[0];
+	const char* ptr = input();
+	const char* end_ptr = ptr + input_size();
 
-	print_status("Reading PNG File", 0, 100);
+	report_progress("Reading PNG File", 0, 100);
 
 	ptr = read_bytes(ptr, &_signature);
 	_signature = _byteswap_uint64(_signature);
@@ -274,58 +553,86 @@ void PNG::read() {
 	int chunk_length = 0;
 	char chunk_type[4] = { ' ', ' ', ' ', ' ' };
 
-	do {
+	while (end_ptr - ptr >= 12) {
 		ptr = read_bytes(ptr, &chunk_length);
 		chunk_length = _byteswap_ulong(chunk_length);
 		memcpy(chunk_type, ptr, 4);
 		ptr += 4;
-		
-		if(compare_chunk_type(chunk_type, IHDR_CHUNK)) {
-			ptr = read_IHDR(chunk_length, ptr);
-		}
 
-		if(compare_chunk_type(chunk_type, sRGB_CHUNK)) {
-			ptr = read_sRGB(chunk_length, ptr);
-		}
-		
-		else if(compare_chunk_type(chunk_type, gAMA_CHUNK)) {
-			ptr = read_gAMA(chunk_length, ptr);
+		if(chunk_length < 0 || end_ptr - ptr < chunk_length + 4) {
+			std::cout << "Truncated PNG chunk" << '\n';
+			break;
 		}
 
-		else if(compare_chunk_type(chunk_type, pHYs_CHUNK)) {
-			ptr = read_pHYs(chunk_length, ptr);
+		if(compare_chunk_type(chunk_type, IDAT_CHUNK)) {
+			ptr = read_IDAT(chunk_length, ptr);  // checks the crc of every IDAT it takes in
+
+			if(!ptr) {
+				break;
+			}
 		}
+		else if(!chunk_crc_ok(ptr - 4, chunk_length)) {
+			std::cout << "CRC mismatch in " << std::string_view(chunk_type, 4) << " chunk" << '\n';
 
-		else if(compare_chunk_type(chunk_type, IDAT_CHUNK)) {
-			ptr = read_IDAT(chunk_length, ptr);
+			if(is_critical_chunk(chunk_type)) {
+				break;
+			}
+			ptr += chunk_length + 4;  // ancillary, skipped
 		}
-		
-		else if(compare_chunk_type(chunk_type, tEXt_CHUNK)) {
-			ptr = read_tEXt(chunk_length, ptr);
+		else {
+			ptr = read_chunk(chunk_type, chunk_length, ptr);
 		}
 
-		else if(compare_chunk_type(chunk_type, zTXt_CHUNK)) {
-			ptr = read_zTXt(chunk_length, ptr);
+		if(compare_chunk_type(chunk_type, IEND_CHUNK)) { // end chunk
+			break;
 		}
+	}
 
-		else if(compare_chunk_type(chunk_type, iTXt_CHUNK)) {
-			ptr = read_iTXt(chunk_length, ptr);
-		}
+}
 
-		else if (compare_chunk_type(chunk_type, cHRM_CHUNK)) {
-			ptr = read_cHRM(chunk_length, ptr);
-		}
+bool PNG::is_parsed_chunk(const char* type) {
+	return compare_chunk_type(type, IHDR_CHUNK) || compare_chunk_type(type, sRGB_CHUNK) ||
+		   compare_chunk_type(type, gAMA_CHUNK) || compare_chunk_type(type, pHYs_CHUNK);
+}
 
-		else {
-			ptr -= 7;
-		}
+const char* PNG::read_chunk(const char* type, int chunk_length, const char* ptr) {
+	if(compare_chunk_type(type, IHDR_CHUNK)) {
+		return read_IHDR(chunk_length, ptr);
+	}
+
+	else if(compare_chunk_type(type, sRGB_CHUNK)) {
+		return read_sRGB(chunk_length, ptr);
+	}
+
+	else if(compare_chunk_type(type, gAMA_CHUNK)) {
+		return read_gAMA(chunk_length, ptr);
+	}
+
+	else if(compare_chunk_type(type, pHYs_CHUNK)) {
+		return read_pHYs(chunk_length, ptr);
+	}
+
+	else if(compare_chunk_type(type, tEXt_CHUNK)) {
+		return read_tEXt(chunk_length, ptr);
+	}
+
+	else if(compare_chunk_type(type, zTXt_CHUNK)) {
+		return read_zTXt(chunk_length, ptr);
+	}
 
-	} while (!compare_chunk_type(chunk_type, IEND_CHUNK)); // end chunk
+	else if(compare_chunk_type(type, iTXt_CHUNK)) {
+		return read_iTXt(chunk_length, ptr);
+	}
+
+	else if(compare_chunk_type(type, cHRM_CHUNK)) {
+		return read_cHRM(chunk_length, ptr);
+	}
 
+	return ptr + chunk_length + 4; // unknown chunk + crc
 }
 
-char* PNG::read_IHDR(int chunk_length, char* ptr) {
-	print_status("Reading IHDR", 0, 100);
+const char* PNG::read_IHDR(int chunk_length, const char* ptr) {
+	report_progress("Reading IHDR", 0, 100);
 
 	_ihdr_chunk._length = chunk_length;
 
@@ -344,15 +651,15 @@ char* PNG::read_IHDR(int chunk_length, char* ptr) {
 	ptr = read_bytes(ptr, &_ihdr_chunk._crc);
 	_ihdr_chunk._crc = _byteswap_ulong(_ihdr_chunk._crc);
 	
-	print_status("Reading IHDR", 100, 100);
+	report_progress("Reading IHDR", 100, 100);
 
 	return ptr;
 }
 
-char* PNG::read_sRGB(int chunk_length, char* ptr) {
-	print_status("Reading sRGB", 0, 100);
+const char* PNG::read_sRGB(int chunk_length, const char* ptr) {
+	report_progress("Reading sRGB", 0, 100);
 
-	_srgb_chunk = std::make_unique<sRGB>();
+	_srgb_chunk.emplace();
 	_srgb_chunk->_length = chunk_length;
 	memcpy(_srgb_chunk->_type, sRGB_CHUNK, 4);
 
@@ -360,15 +667,15 @@ char* PNG::read_sRGB(int chunk_length, char* ptr) {
 	ptr = read_bytes(ptr, &_srgb_chunk->_crc);
 	_srgb_chunk->_crc = _byteswap_ulong(_srgb_chunk->_crc);
 
-	print_status("Reading sRGB", 100, 100);
+	report_progress("Reading sRGB", 100, 100);
 
 	return ptr;
 }
 
-char* PNG::read_gAMA(int chunk_length, char* ptr) {
-	print_status("Reading gAMA", 0, 100);
+const char* PNG::read_gAMA(int chunk_length, const char* ptr) {
+	report_progress("Reading gAMA", 0, 100);
 
-	_gama_chunk = std::make_unique<gAMA>();
+	_gama_chunk.emplace();
 	_gama_chunk->_length = chunk_length;
 	memcpy(_gama_chunk->_type, gAMA_CHUNK, 4);
 
@@ -377,15 +684,15 @@ char* PNG::read_gAMA(int chunk_length, char* ptr) {
 	ptr = read_bytes(ptr, &_gama_chunk->_crc);
 	_gama_chunk->_crc = _byteswap_ulong(_gama_chunk->_crc);
 
-	print_status("Reading gAMA", 100, 100);
+	report_progress("Reading gAMA", 100, 100);
 
 	return ptr;
 }
 
-char* PNG::read_pHYs(int chunk_length, char* ptr) {
-	print_status("Reading pHYs", 0, 100);
+const char* PNG::read_pHYs(int chunk_length, const char* ptr) {
+	report_progress("Reading pHYs", 0, 100);
 
-	_phys_chunk = std::make_unique<pHYs>();
+	_phys_chunk.emplace();
 	_phys_chunk->_length = chunk_length;
 	memcpy(_phys_chunk->_type, pHYs_CHUNK, 4);
 
@@ -397,39 +704,59 @@ char* PNG::read_pHYs(int chunk_length, char* ptr) {
 	ptr = read_bytes(ptr, &_phys_chunk->_crc);
 	_phys_chunk->_crc = _byteswap_ulong(_phys_chunk->_crc);
 
-	print_status("Reading pHYs", 100, 100);
+	report_progress("Reading pHYs", 100, 100);
 
 	return ptr;
 }
 
-char* PNG::read_IDAT(int chunk_length, char* ptr) {
-	print_status("Reading IDAT", 0, 100);
+const char* PNG::read_IDAT(int chunk_length, const char* ptr) {
+	report_progress("Reading IDAT", 0, 100);
 
 	_idat_chunk._length = chunk_length;
 	memcpy(_idat_chunk._type, IDAT_CHUNK, 4);
 
-	// Read all IDAT chunks and add compressed data to _pixel_data
-	char next_chunk[4] = { ' ', ' ', ' ', ' ' };
-	do {
-		auto length = _idat_chunk._pixel_data.size();
-		_idat_chunk._pixel_data.resize(_idat_chunk._pixel_data.size() + chunk_length);
-		memcpy(&_idat_chunk._pixel_data[length], ptr, chunk_length);
+	// Record where each consecutive IDAT payload sits in the input, the compressed stream is never copied
+	const char* start_ptr = input();
+	const char* end_ptr = start_ptr + input_size();
+
+	_idat_chunk._spans.reserve(_idat_chunk._spans.size() + (end_ptr - ptr) / (size_t(chunk_length) + 12) + 1); // exact when the encoder uses a fixed chunk size
+
+	for (;;) {
+		if(!chunk_crc_ok(ptr - 4, chunk_length)) { // nothing is decoded from a stream with a bad piece
+			std::cout << "CRC mismatch in IDAT chunk" << '\n';
+			_idat_chunk._spans.clear();
+			return nullptr;
+		}
+
+		_idat_chunk._spans.push_back({ size_t(ptr - start_ptr), size_t(chunk_length) });
 		ptr += chunk_length + 4; // + crc
 
-		ptr = read_bytes(ptr, &chunk_length);
+		if(end_ptr - ptr < 12 || !compare_chunk_type(ptr + 4, IDAT_CHUNK)) {
+			break;
+		}
+
+		read_bytes(ptr, &chunk_length);
 		chunk_length = _byteswap_ulong(chunk_length);
-		memcpy(next_chunk, ptr, 4);
-		ptr += 4;
 
-	} while (compare_chunk_type(next_chunk, IDAT_CHUNK));
+		if(chunk_length < 0 || end_ptr - ptr < chunk_length + 12) {
+			break;
+		}
 
-	ptr -= 8;
+		ptr += 8;
+	}
 
-	print_status("Reading IDAT", 50, 100);
-	print_status("Decompressing", 0, 100);
+	report_progress("Reading IDAT", 50, 100);
+
+	uint8_t header[2] = { 0, 0 };
+	size_t header_size = 0;
+	for (auto& span : _idat_chunk._spans) { // the zlib header could in theory be split over chunks
+		for (size_t i = 0; i < span._length && header_size < 2; ++i) {
+			header[header_size++] = uint8_t(start_ptr[span._offset + i]);
+		}
+	}
 
-	const uint8_t first_byte = _idat_chunk._pixel_data[0];
-	const uint8_t second_byte = _idat_chunk._pixel_data[1];
+	const uint8_t first_byte = header[0];
+	const uint8_t second_byte = header[1];
 
 	_idat_chunk._compression_method = LOW_NIBBLE(first_byte);
 	_idat_chunk._compression_info = HI_NIBBLE(first_byte);
@@ -448,40 +775,15 @@ char* PNG::read_IDAT(int chunk_length, char* ptr) {
 	}
 
 
-	if(_ihdr_chunk._color_type == 6) {
-		_idat_chunk._length_uncompressed = ((_ihdr_chunk._width * _ihdr_chunk._height) * 4) + _ihdr_chunk._height;
-	}
-
-	_idat_chunk._pixel_data_uncompressed.resize(_idat_chunk._length_uncompressed);
-
-	z_stream stream;
-
-	stream.zalloc = Z_NULL;
-	stream.zfree = Z_NULL;
-	stream.opaque = Z_NULL;
-	stream.avail_in = _idat_chunk._pixel_data.size();
-	stream.next_in = (Bytef*)&_idat_chunk._pixel_data[0];
-	stream.avail_out = _idat_chunk._length_uncompressed;
-	stream.next_out = (Bytef*)&_idat_chunk._pixel_data_uncompressed[0];
-
-	int ret = inflateInit(&stream);
-	assert(ret == Z_OK);
-
-	ret = inflate(&stream, Z_NO_FLUSH);
-
-	ret = inflateEnd(&stream);
-
-	print_status("Decompressing", 100, 100);
-
-	print_status("Reading IDAT", 100, 100);
+	report_progress("Reading IDAT", 100, 100);
 
 	return ptr;
 }
 
-char *PNG::read_tEXt(int chunk_length, char* ptr) {
-	print_status("Reading tEXt", 0, 100);
+const char *PNG::read_tEXt(int chunk_length, const char* ptr) {
+	report_progress("Reading tEXt", 0, 100);
 
-	char *start_ptr = ptr;
+	const char *start_ptr = ptr;
 
 	std::string keyword = ptr;
 	ptr += keyword.size() + 1;
@@ -492,134 +794,261 @@ char *PNG::read_tEXt(int chunk_length, char* ptr) {
 
 	ptr += text.size() + 4;
 
-	print_status("Reading tEXt", 100, 100);
+	report_progress("Reading tEXt", 100, 100);
 
 	return ptr;
 }
 
-char *PNG::read_zTXt(int chunk_length, char* ptr) {
-	print_status("Reading zTXt", 0, 100);
+const char *PNG::read_zTXt(int chunk_length, const char* ptr) {
+	report_progress("Reading zTXt", 0, 100);
 
 	ptr += chunk_length + 4;
 
-	print_status("Reading zTXt", 100, 100);
+	report_progress("Reading zTXt", 100, 100);
 
 	return ptr;
 }
 
-char *PNG::read_iTXt(int chunk_length, char* ptr) {
-	print_status("Reading iTXt", 0, 100);
+const char *PNG::read_iTXt(int chunk_length, const char* ptr) {
+	report_progress("Reading iTXt", 0, 100);
 
 	ptr += chunk_length + 4;
 
-	print_status("Reading iTXt", 100, 100);
+	report_progress("Reading iTXt", 100, 100);
 
 	return ptr;
 }
 
-char *PNG::read_cHRM(int chunk_length, char* ptr) {
-	print_status("Reading cHRM", 0, 100);
+const char *PNG::read_cHRM(int chunk_length, const char* ptr) {
+	report_progress("Reading cHRM", 0, 100);
 
 	ptr += chunk_length + 4;
 
-	print_status("Reading cHRM", 100, 100);
+	report_progress("Reading cHRM", 100, 100);
 
 	return ptr;
 }
 
-void PNG::save(const char* name) {
+constexpr size_t IDAT_CHUNK_SIZE = 1 << 20;
 
+static char* write_big_endian(char* ptr, unsigned int value) {
+	return write_bytes(ptr, (unsigned int)_byteswap_ulong(value));
 }
 
-char paeth_filter(char a, char b, char c) { // a = left pixel, b = up pixel, c = up left pixel
-	const short _a = uint8_t(a);
-	const short _b = uint8_t(b);
-	const short _c = uint8_t(c);
+// Length, type, data and crc
+static void append_chunk(std::vector<char>& file, const char* type, const char* data, size_t size) {
+	const size_t start = file.size();
+	file.resize(start + size + 12);
 
-	const short p = _a + _b - _c;
-	const short pa = abs(p - _a);
-	const short pb = abs(p - _b);
-	const short pc = abs(p - _c);
+	char* ptr = &file[start];
+	ptr = write_big_endian(ptr, (unsigned int)size);
 
-	if		(pa <= pb && pa <= pc)   return a;
-	else if (pb <= pc)			     return b;
-	else							 return c;
-}
+	memcpy(ptr, type, 4);
+	memcpy(ptr + 4, data, size);
 
-char average_filter(char a, char b) { // a = left pixel, b = up pixel
-	const short _a = uint8_t(a);
-	const short _b = uint8_t(b);
+	const unsigned int crc = update_crc32(0, ptr, size + 4);
+	write_big_endian(ptr + 4 + size, crc);
+}
 
-	return (_a + _b) / 2;
+void PNG::save(const char* name) {
+	save(name, EncodeOptions());
 }
 
-std::vector<char> PNG::raw_pixels() {
-	std::vector<char> pixels;
-	pixels.resize(_idat_chunk._length_uncompressed - _ihdr_chunk._height);
+bool PNG::save(const char* name, const EncodeOptions& options) {
+	std::string path = name;
+	path.append(".png");
 
-	const int bytes_per_pixel = 4;
-	const int bytes_per_row = bytes_per_pixel * _ihdr_chunk._width;
-	char* start_ptr = &_idat_chunk._pixel_data_uncompressed[0];
-	char* end_ptr = &_idat_chunk._pixel_data_uncompressed[0] + _idat_chunk._length_uncompressed;
+	report_progress("Saving PNG File", 0, 100);
 
-	char* ptr = start_ptr;
+	if(_ihdr_chunk._color_type == 3) {
+		std::cout << "Saving palette PNGs is not supported" << '\n';
+		return false;
+	}
 
-	for (int i = 0; ptr <= end_ptr; i += bytes_per_row) {
+	const int height = _ihdr_chunk._height;
+	const size_t bytes_per_row = this->bytes_per_row();
 
-		char filter_method;
-		memcpy(&filter_method, ptr, 1);
+	std::vector<char> decoded;
+	if(_pixels.empty()) {
+		decoded.resize(bytes_per_row * height);
 
-		if (filter_method == 0) { // no filter
-			memcpy(&pixels[i], ptr + 1, bytes_per_row);
-		}
-		else if (filter_method == 1) { // sub filter 
-			for (int byte = 0; byte < bytes_per_row; ++byte) {
-				if (byte < 4) {
-					pixels[i + byte] = *(ptr + byte + 1);
-				}
-				else {
-					pixels[i + byte] = pixels[i + byte - 4] + *(ptr + byte + 1);
-				}
-			}
-		}
-		else if (filter_method == 2) { // up filter
-			for (int byte = 0; byte < bytes_per_row; ++byte) {
-				pixels[i + byte] = pixels[i + byte - bytes_per_row] + *(ptr + byte + 1);
-			}
+		const bool ok = decode_parallel([&](int row, const char* pixels) {
+			memcpy(&decoded[row * bytes_per_row], pixels, bytes_per_row);
+		}, decode_threads());
+
+		if(!ok) {
+			return false;
 		}
-		else if(filter_method == 3) { // average filter
-			for (int byte = 0; byte < bytes_per_row; ++byte) {
-				if(byte < 4) {
-					pixels[i + byte] = average_filter(char(0), pixels[i + byte - bytes_per_row]) + *(ptr + byte + 1);
-				}
-				else {
-					pixels[i + byte] = average_filter(pixels[i + byte - 4], pixels[i + byte - bytes_per_row]) + *(ptr + byte + 1);
- 				}
-			}
+	}
+
+	const char* pixels = _pixels.empty() ? decoded.data() : _pixels.data();
+
+	std::vector<char> stream;
+	if(!compress_scanlines(pixels, int(bytes_per_row), bytes_per_pixel(), height, options, stream)) {
+		std::cout << "Unable to compress image" << '\n';
+		return false;
+	}
+
+	std::vector<char>().swap(decoded);
+
+	std::vector<char> file;
+	file.reserve(stream.size() + (stream.size() / IDAT_CHUNK_SIZE + 1) * 12 + 128);
+
+	file.insert(file.end(), PNG_SIGNATURE, PNG_SIGNATURE + 8);
+
+	char ihdr[13];
+	char* ptr = ihdr;
+	ptr = write_big_endian(ptr, _ihdr_chunk._width);
+	ptr = write_big_endian(ptr, _ihdr_chunk._height);
+	ptr = write_bytes(ptr, _ihdr_chunk._bit_depth);
+	ptr = write_bytes(ptr, _ihdr_chunk._color_type);
+	ptr = write_bytes(ptr, char(0)); // deflate
+	ptr = write_bytes(ptr, char(0)); // adaptive filtering
+	ptr = write_bytes(ptr, char(0)); // not interlaced
+	append_chunk(file, IHDR_CHUNK, ihdr, sizeof(ihdr));
+
+	if(_gama_chunk) {
+		char gama[4];
+		write_big_endian(gama, _gama_chunk->_gamma);
+		append_chunk(file, gAMA_CHUNK, gama, sizeof(gama));
+	}
+
+	if(_srgb_chunk) {
+		append_chunk(file, sRGB_CHUNK, &_srgb_chunk->_rendering_intent, 1);
+	}
+
+	if(_phys_chunk) {
+		char phys[9];
+		ptr = phys;
+		ptr = write_big_endian(ptr, _phys_chunk->_pixels_per_unit_x);
+		ptr = write_big_endian(ptr, _phys_chunk->_pixels_per_unit_y);
+		ptr = write_bytes(ptr, _phys_chunk->_unit_specifier);
+		append_chunk(file, pHYs_CHUNK, phys, sizeof(phys));
+	}
+
+	for (size_t offset = 0; offset < stream.size(); offset += IDAT_CHUNK_SIZE) {
+		append_chunk(file, IDAT_CHUNK, &stream[offset], std::min(IDAT_CHUNK_SIZE, stream.size() - offset));
+	}
+
+	append_chunk(file, IEND_CHUNK, nullptr, 0);
+
+	const bool ok = write_file(path, { { file.data(), file.size() } });
+
+	if(!ok) {
+		std::cout << "Unable to write file" << '\n';
+	}
+
+	report_progress("Saving PNG File", 100, 100);
+
+	return ok;
+}
+
+static int png_channels(int color_type) {
+	switch (color_type) {
+	case 2:  return 3;  // truecolor
+	case 4:  return 2;  // grayscale + alpha
+	case 6:  return 4;  // truecolor + alpha
+	default: return 1;  // grayscale, palette
+	}
+}
+
+int PNG::channels() const {
+	return png_channels(_ihdr_chunk._color_type);
+}
+
+int PNG::bytes_per_pixel() const {
+	const int bits = channels() * _ihdr_chunk._bit_depth;
+
+	return bits < 8 ? 1 : bits / 8;
+}
+
+int PNG::bytes_per_row() const {
+	return int((int64_t(_ihdr_chunk._width) * channels() * _ihdr_chunk._bit_depth + 7) / 8);
+}
+
+bool PNG::decode(const RowSink& sink) {
+	const int height = _ihdr_chunk._height;
+	const size_t bytes_per_row = this->bytes_per_row();
+
+	if(!_pixels.empty()) { // already reconstructed while streaming
+		for (int row = 0; row < height; ++row) {
+			sink(row, &_pixels[row * bytes_per_row]);
 		}
-		else if(filter_method == 4) { // Paeth filter
-			for (int byte = 0; byte < bytes_per_row; ++byte) {
-				if (byte < 4) {
-					pixels[i + byte] = paeth_filter(char(0), pixels[i + byte - bytes_per_row], char(0)) + *(ptr + byte + 1);
-				}
-				else {
-					pixels[i + byte] = paeth_filter(pixels[i + byte - 4], pixels[i + byte - bytes_per_row], pixels[i + byte - bytes_per_row - 4]) + *(ptr + byte + 1);
-				}
-			}
+		return true;
+	}
+
+	if(_ihdr_chunk._interlace != 0) {
+		std::cout << "Interlaced PNGs are not supported" << '\n';
+		return false;
+	}
+
+	report_progress("Decompressing", 0, 100);
+
+	ProgressThrottle progress("Defiltering", height);
+
+	ScanlineDecoder decoder(int(bytes_per_row), bytes_per_pixel(), height, [&](int row, const char* pixels) {
+		sink(row, pixels);
+
+		progress.update(row);
+	});
+
+	const char* start_ptr = input();
+
+	bool ok = true;
+	for (auto& span : _idat_chunk._spans) { // each chunk's payload goes to inflate in place
+		if(!decoder.feed(start_ptr + span._offset, span._length)) {
+			ok = false;
+			break;
 		}
+	}
+	ok = ok && decoder.finish();
+
+	report_progress("Decompressing", 100, 100);
 
-		ptr += bytes_per_row + 1;
+	if(!ok || !decoder.done()) {
+		std::cout << "Corrupt IDAT data" << '\n';
+		return false;
+	}
+
+	return true;
+}
+
+bool PNG::decode_parallel(const RowSink& sink, int threads) {
+	if(!_pixels.empty() || threads <= 1) {
+		return decode(sink);
+	}
 
-		print_status("Defiltering", i, pixels.size());
+	if(_ihdr_chunk._interlace != 0) {
+		std::cout << "Interlaced PNGs are not supported" << '\n';
+		return false;
 	}
 
-	/*
-	std::ofstream test_file("raw_uncompressed.x", std::ios::binary | std::ios::trunc);
+	std::vector<StreamPiece> pieces;
+	for (auto& span : _idat_chunk._spans) {
+		pieces.push_back({ input() + span._offset, span._length });
+	}
 
-	test_file.write(&_idat_chunk._pixel_data_uncompressed[0], _idat_chunk._length_uncompressed);
+	if(!decode_scanlines_parallel(pieces, bytes_per_row(), bytes_per_pixel(), _ihdr_chunk._height, sink, threads)) {
+		std::cout << "Corrupt IDAT data" << '\n';
+		return false;
+	}
 
-	test_file.close();
-	*/
+	return true;
+}
+
+std::vector<char> PNG::raw_pixels() {
+	if(!_pixels.empty()) {
+		return _pixels;
+	}
+
+	const size_t bytes_per_row = this->bytes_per_row();
+
+	std::vector<char> pixels;
+	pixels.resize(bytes_per_row * _ihdr_chunk._height);
+
+	decode_parallel([&](int row, const char* scanline) {
+		memcpy(&pixels[row * bytes_per_row], scanline, bytes_per_row);
+	}, decode_threads());
 
 	return pixels;
 }
@@ -641,7 +1070,7 @@ int PNG::get_type() {
 	return TYPE_PNG;
 }
 
-BMP PNG::to_bmp() {
+BMP PNG::bmp_header() const {
 	BMP bmp;
 	
 	bmp._file = _file;
@@ -669,18 +1098,202 @@ BMP PNG::to_bmp() {
 	bmp._bit_masks._blue = Bytes56;
 	bmp._bit_masks._alpha = Bytes78;
 
-	bmp._pixel_data = flip_scanlines(raw_pixels(), 4, bmp._width);
-	bmp._image_size = bmp._pixel_data.size();
+	bmp._image_size = bmp._width * 4 * bmp._height;
 	bmp._file_size = 122 + bmp._image_size;
 
+	return bmp;
+}
+
+// The BMP is written as 32 bit RGBA, which only 8 bit truecolor + alpha PNGs map onto
+bool PNG::has_bmp_layout() const {
+	if(_ihdr_chunk._color_type != 6 || _ihdr_chunk._bit_depth != 8 || _ihdr_chunk._interlace != 0) {
+		std::cout << "Only 8 bit RGBA PNGs can be converted to BMP" << '\n';
+		return false;
+	}
+	return true;
+}
+
+BMP PNG::to_bmp() & {
+	BMP bmp = bmp_header();
+
+	// BMP rows are stored bottom up, each scanline goes straight to its final row as it comes out of the decoder
+	const size_t bytes_per_row = size_t(bmp._width) * 4;
+	const int height = bmp._height;
+
+	if(!has_bmp_layout()) {
+		return bmp;
+	}
+
+	bmp._pixel_data.resize(bytes_per_row * height);
+
+	const bool ok = decode_parallel([&](int row, const char* pixels) {
+		memcpy(&bmp._pixel_data[(height - 1 - row) * bytes_per_row], pixels, bytes_per_row);
+	}, decode_threads());
+
+	if(!ok) { // nothing half decoded gets saved
+		std::vector<char>().swap(bmp._pixel_data);
+	}
+
 	_file_size = bmp._file_size;
 
 	return bmp;
 }
 
-PNG PNG::to_png() {
-	PNG png;
-	return png;
+BMP PNG::to_bmp() && {
+	BMP bmp = bmp_header();
+
+	const size_t bytes_per_row = size_t(bmp._width) * 4;
+	const int height = bmp._height;
+
+	if(!has_bmp_layout()) {
+		return bmp;
+	}
+
+	if(!_pixels.empty() && size_t(this->bytes_per_row()) == bytes_per_row) {
+		// already decoded by the stream decoder in the same layout, flip it in place and take the buffer
+		std::vector<char> row(bytes_per_row);
+
+		for (int top = 0, bottom = height - 1; top < bottom; ++top, --bottom) {
+			char* top_row = &_pixels[top * bytes_per_row];
+			char* bottom_row = &_pixels[bottom * bytes_per_row];
+
+			memcpy(row.data(), top_row, bytes_per_row);
+			memcpy(top_row, bottom_row, bytes_per_row);
+			memcpy(bottom_row, row.data(), bytes_per_row);
+		}
+
+		bmp._pixel_data = std::move(_pixels);
+	}
+	else {
+		bmp._pixel_data.resize(bytes_per_row * height);
+
+		const bool ok = decode_parallel([&](int row, const char* pixels) {
+			memcpy(&bmp._pixel_data[(height - 1 - row) * bytes_per_row], pixels, bytes_per_row);
+		}, decode_threads());
+
+		if(!ok) {
+			std::vector<char>().swap(bmp._pixel_data);
+		}
+
+		std::vector<char>().swap(_pixels);
+	}
+
+	// the compressed input is used up, free it before the caller gets the BMP
+	release_input();
+	_idat_chunk._spans = {};
+
+	_file_size = bmp._file_size;
+
+	return bmp;
+}
+
+PNG PNG::to_png() & {
+	return *this;
+}
+
+PNG PNG::to_png() && {
+	return std::move(*this);
+}
+
+// *********************************************************************************************************************************************************************************************************************
+
+// The signature and IHDR are the first 33 bytes of a PNG, IHDR has to come first
+static bool probe_png(const char* data, size_t size, ImageInfo& info) {
+	if(size < 33) {
+		return false;
+	}
+
+	int length = 0;
+	read_bytes(data + 8, &length);
+
+	if(_byteswap_ulong(length) != 13 || !compare_chunk_type(data + 12, IHDR_CHUNK) || !chunk_crc_ok(data + 12, 13)) {
+		return false;
+	}
+
+	int width = 0;
+	int height = 0;
+	read_bytes(data + 16, &width);
+	read_bytes(data + 20, &height);
+
+	info._type = TYPE_PNG;
+	info._width = int(_byteswap_ulong(width));
+	info._height = int(_byteswap_ulong(height));
+	info._bit_depth = uint8_t(data[24]);
+	info._color_type = uint8_t(data[25]);
+	info._channels = png_channels(info._color_type);
+	info._interlaced = data[28] != 0;
+
+	return info._width > 0 && info._height > 0 && info._bit_depth > 0;
+}
+
+// Same fields BMP::read looks at, the alpha mask decides between 3 and 4 channels at 32 bits
+static bool probe_bmp(const char* data, size_t size, ImageInfo& info) {
+	if(size < 54) {
+		return false;
+	}
+
+	int header_size = 0;
+	int width = 0;
+	int height = 0;
+	short bits_per_pixel = 0;
+	int compression = 0;
+
+	read_bytes(data + 14, &header_size);
+	read_bytes(data + 18, &width);
+	read_bytes(data + 22, &height);
+	read_bytes(data + 28, &bits_per_pixel);
+	read_bytes(data + 30, &compression);
+
+	unsigned int alpha_mask = 0;
+	if((compression == 3 && header_size >= 56 && size >= 70) || (compression == 6 && size >= 70)) {
+		read_bytes(data + 66, &alpha_mask);
+	}
+
+	info._type = TYPE_BMP;
+	info._width = width;
+	info._height = height < 0 ? -height : height;
+	info._bit_depth = bits_per_pixel;
+	info._compression = compression;
+	info._channels = bits_per_pixel <= 8 ? 1 : bits_per_pixel == 32 && alpha_mask ? 4 : 3;
+	info._top_down = height < 0;
+
+	return width > 0 && height != 0 && bits_per_pixel > 0;
+}
+
+bool probe_image(const char* data, size_t size, ImageInfo& info) {
+	info = ImageInfo();
+
+	if(size >= 8 && memcmp(data, PNG_SIGNATURE, 8) == 0) {
+		return probe_png(data, size, info);
+	}
+
+	if(size >= 2 && data[0] == 'B' && data[1] == 'M') {
+		return probe_bmp(data, size, info);
+	}
+
+	return false;
+}
+
+bool probe_image(std::string_view file, ImageInfo& info) {
+	char header[PROBE_SIZE];
+	const size_t size = read_file_start(file, header, sizeof(header));
+
+	return probe_image(header, size, info);
 }
 
-// *********************************************************************************************************************************************************************************************************************
\ No newline at end of file
+void print_info(const ImageInfo& info) {
+	fmt_out("Type", info._type == TYPE_PNG ? "png" : info._type == TYPE_BMP ? "bmp" : "unknown");
+	fmt_out("Width", info._width);
+	fmt_out("Height", info._height);
+	fmt_out("Bit Depth", info._bit_depth);
+	fmt_out("Channels", info._channels);
+
+	if(info._type == TYPE_PNG) {
+		fmt_out("Color Type", info._color_type);
+		fmt_out("Interlace", int(info._interlaced));
+	}
+	else if(info._type == TYPE_BMP) {
+		fmt_out("Compression", info._compression);
+		fmt_out("Top Down", int(info._top_down));
+	}
+}
@@ -2,38 +2,86 @@
 #define IMAGE_H
 
 #include <memory>
+#include <optional>
 #include <cstdint>
 #include <vector>
 #include <string>
 #include <string_view>
+#include <functional>
+
+#include "Encoder.h"
 
 #define TYPE_BMP 0
 #define TYPE_PNG 1
 
+#define BMP_HEADER_SIZE 122  // 14 byte file header + 108 byte BITMAPV4HEADER
+
 class Image;
 class BMP;
 class PNG;
+class MappedFile;
+
+// Receives each reconstructed scanline as soon as it's defiltered, pixels are only valid during the call
+using RowSink = std::function<void(int row, const char* pixels)>;
+
+#define PROBE_SIZE 128  // covers the PNG signature and IHDR and a BMP file header + BITMAPV4HEADER
+
+// What the headers say about an image, filled in by probe_image without reading the pixels
+struct ImageInfo {
+	int _type = -1;        // TYPE_BMP or TYPE_PNG
+	int _width = 0;
+	int _height = 0;
+	int _bit_depth = 0;    // per channel for PNG, per pixel for BMP
+	int _color_type = -1;  // PNG only
+	int _compression = 0;  // BMP only
+	int _channels = 0;
+	bool _interlaced = false;
+	bool _top_down = false;
+};
+
+// Reads at most PROBE_SIZE bytes from the start of the file, nothing is mapped or decompressed
+// returns false if it's neither a PNG nor a BMP or the header doesn't make sense
+bool probe_image(std::string_view file, ImageInfo& info);
+bool probe_image(const char* data, size_t size, ImageInfo& info);
+
+void print_info(const ImageInfo& info);
 
 class ImageReader {
 public:
 	ImageReader(std::string_view file);
 
 	Image* image();
+	std::unique_ptr<Image> release();  // hands over the image, e.g. to convert it with std::move(*image).to_bmp()
 private:
 	std::unique_ptr<Image> _image;
 };
 
 class Image {
 public:
+	Image() = default;
+	Image(const Image&) = default;
+	Image(Image&&) = default;
+	Image& operator=(const Image&) = default;
+	Image& operator=(Image&&) = default;
+	virtual ~Image() = default;
+
 	std::vector<char> *get_data();
 
+	const char* input() const;  // mapped file if there is one, otherwise _data
+	size_t input_size() const;
+
 	virtual void read() = 0;
 	virtual void save(const char* name) = 0;
 	virtual void print_info() = 0;
 	virtual int get_type() = 0;
 
-	virtual BMP to_bmp() = 0;
-	virtual PNG to_png() = 0;
+	// Lvalue conversions copy and leave the source usable, rvalue ones consume it and reuse or free its buffers as they go
+	virtual BMP to_bmp() & = 0;
+	virtual BMP to_bmp() && = 0;
+	virtual PNG to_png() & = 0;
+	virtual PNG to_png() && = 0;
+
+	void release_input();  // drops the file mapping or the owned copy of the file
 
 	std::string _file;
 	std::string _file_type;
@@ -41,6 +89,7 @@ public:
 	int _file_size;
 
 	std::vector<char> _data;
+	std::shared_ptr<MappedFile> _mapping;
 };
 
 // *********************************************************************************************************************************************************************************************************************
@@ -58,11 +107,16 @@ public:
 
 	void read();
 	void save(const char* name);
+	bool save(const char* name, int write_flags);  // WRITE_* flags from FileIO.h
 	void print_info();
 	int get_type();
 
-	BMP to_bmp();
-	PNG to_png();
+	BMP to_bmp() &;
+	BMP to_bmp() &&;
+	PNG to_png() &;
+	PNG to_png() &&;
+
+	size_t write_header(char* ptr) const;  // file header + BITMAPV4HEADER, ptr needs BMP_HEADER_SIZE bytes
 
 	short _signature;
 	int _file_size;
@@ -91,6 +145,9 @@ public:
 
 	std::vector<char> _pixel_data;
 private:
+	PNG png_header() const;
+	bool has_png_layout() const;
+	bool unpack_rows(std::vector<char>& pixels) const;
 };
 
 // *********************************************************************************************************************************************************************************************************************
@@ -120,10 +177,12 @@ public:
 	};
 
 	struct IDAT : public Chunk {
-		std::vector<char> _pixel_data;
-		std::vector<char> _pixel_data_uncompressed;
+		struct Span {  // payload of one IDAT chunk, relative to input()
+			size_t _offset;
+			size_t _length;
+		};
 
-		size_t _length_uncompressed;
+		std::vector<Span> _spans;
 
 		uint8_t _compression_method;
 		uint8_t _compression_info;
@@ -150,34 +209,50 @@ public:
 
 	void read();
 	void save(const char* name);
+	bool save(const char* name, const EncodeOptions& options);
 	void print_info();
 	int get_type();
 
-	BMP to_bmp();
-	PNG to_png();
+	BMP to_bmp() &;
+	BMP to_bmp() &&;
+	PNG to_png() &;
+	PNG to_png() &&;
 
+	bool decode(const RowSink& sink);  // inflates and defilters row by row, handing each scanline to sink in order
+	bool decode_parallel(const RowSink& sink, int threads);  // same, but rows reach sink out of order and from several threads at once
 	std::vector<char> raw_pixels();
 
-	char* read_IHDR(int chunk_length, char* ptr);
-	char* read_sRGB(int chunk_length, char* ptr);
-	char* read_gAMA(int chunk_length, char* ptr);
-	char* read_pHYs(int chunk_length, char* ptr);
-	char* read_IDAT(int chunk_length, char* ptr);
-	char* read_tEXt(int chunk_length, char* ptr);
-	char* read_zTXt(int chunk_length, char* ptr);
-	char* read_iTXt(int chunk_length, char* ptr);
-	char* read_cHRM(int chunk_length, char* ptr);
+	int channels() const;
+	int bytes_per_pixel() const;  // rounded up to whole bytes, as used by the filters
+	int bytes_per_row() const;    // without the filter byte
+
+	static bool is_parsed_chunk(const char* type);
+
+	const char* read_chunk(const char* type, int chunk_length, const char* ptr);
+	const char* read_IHDR(int chunk_length, const char* ptr);
+	const char* read_sRGB(int chunk_length, const char* ptr);
+	const char* read_gAMA(int chunk_length, const char* ptr);
+	const char* read_pHYs(int chunk_length, const char* ptr);
+	const char* read_IDAT(int chunk_length, const char* ptr);
+	const char* read_tEXt(int chunk_length, const char* ptr);
+	const char* read_zTXt(int chunk_length, const char* ptr);
+	const char* read_iTXt(int chunk_length, const char* ptr);
+	const char* read_cHRM(int chunk_length, const char* ptr);
 
 	long long _signature;
 
 	IHDR _ihdr_chunk;
 	IDAT _idat_chunk;
 
-	std::unique_ptr<PLTE> _plte_chunk;
-	std::unique_ptr<sRGB> _srgb_chunk;
-	std::unique_ptr<gAMA> _gama_chunk;
-	std::unique_ptr<pHYs> _phys_chunk;
+	std::optional<PLTE> _plte_chunk;
+	std::optional<sRGB> _srgb_chunk;
+	std::optional<gAMA> _gama_chunk;
+	std::optional<pHYs> _phys_chunk;
+
+	std::vector<char> _pixels;  // reconstructed scanlines, filled by PNGStreamDecoder
 private:
+	BMP bmp_header() const;
+	bool has_bmp_layout() const;
 };
 
 // *********************************************************************************************************************************************************************************************************************
@@ -0,0 +1,835 @@
+#include "Inflate.h"
+#include "Checksum.h"
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include <zlib.h>
+
+static std::atomic<InflateBackend> current_backend { INFLATE_DEFAULT_BACKEND };
+
+void set_inflate_backend(InflateBackend backend) {
+	current_backend.store(backend, std::memory_order_relaxed);
+}
+
+InflateBackend inflate_backend() {
+	return current_backend.load(std::memory_order_relaxed);
+}
+
+const char* inflate_backend_name(InflateBackend backend) {
+	return backend == InflateBackend::Zlib ? "zlib" : "fast";
+}
+
+// *********************************************************************************************************************************************************************************************************************
+
+class ZlibInflater : public Inflater {
+public:
+	ZlibInflater() :
+		_stream		( ),
+		_stream_end	( false ),
+		_error		( false )
+	{
+		_stream.zalloc = Z_NULL;
+		_stream.zfree = Z_NULL;
+		_stream.opaque = Z_NULL;
+		_stream.avail_in = 0;
+		_stream.next_in = Z_NULL;
+
+		_error = inflateInit(&_stream) != Z_OK;
+
+		if(!_error && !verify_adler32()) {
+			inflateValidate(&_stream, 0);
+		}
+	}
+
+	~ZlibInflater() {
+		inflateEnd(&_stream);
+	}
+
+	bool streaming() const {
+		return true;
+	}
+
+	void feed(const char* data, size_t size) {
+		_stream.next_in = (Bytef*)data;
+		_stream.avail_in = uInt(size);
+	}
+
+	size_t read(char* out, size_t size) {
+		size_t written = 0;
+
+		while (written < size && !_stream_end && !_error) {
+			_stream.next_out = (Bytef*)out + written;
+			_stream.avail_out = uInt(std::min(size - written, size_t(1) << 30));
+
+			const int ret = inflate(&_stream, Z_NO_FLUSH);
+
+			if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+				_error = true;
+				break;
+			}
+
+			written = size_t((char*)_stream.next_out - out);
+			_stream_end = ret == Z_STREAM_END;
+
+			if(_stream.avail_out > 0 || ret == Z_BUF_ERROR) { // input used up
+				break;
+			}
+		}
+
+		return written;
+	}
+
+	bool ended() const {
+		return _stream_end;
+	}
+
+	bool failed() const {
+		return _error;
+	}
+private:
+	z_stream _stream;
+	bool _stream_end;
+	bool _error;
+};
+
+// *********************************************************************************************************************************************************************************************************************
+
+// Table entries pack everything a lookup needs in 32 bits:
+// bits 0-7 code length, 8-11 kind, 12-15 extra bits (index bits for subtables), 16-31 value
+constexpr uint32_t ENTRY_INVALID = 0;
+constexpr uint32_t ENTRY_LITERAL = 1;
+constexpr uint32_t ENTRY_LITERAL_PAIR = 2;  // two literals, first in the low byte of the value
+constexpr uint32_t ENTRY_LENGTH = 3;
+constexpr uint32_t ENTRY_END = 4;
+constexpr uint32_t ENTRY_DISTANCE = 5;
+constexpr uint32_t ENTRY_SUBTABLE = 6;      // value is the subtable offset
+
+constexpr uint32_t make_entry(uint32_t kind, uint32_t length, uint32_t extra, uint32_t value) {
+	return length | kind << 8 | extra << 12 | value << 16;
+}
+
+constexpr uint32_t entry_length(uint32_t entry) { return entry & 0xff; }
+constexpr uint32_t entry_kind(uint32_t entry) { return (entry >> 8) & 0xf; }
+constexpr uint32_t entry_extra(uint32_t entry) { return (entry >> 12) & 0xf; }
+constexpr uint32_t entry_value(uint32_t entry) { return entry >> 16; }
+
+constexpr int LITLEN_TABLE_BITS = 11;
+constexpr int DISTANCE_TABLE_BITS = 8;
+constexpr int CODELEN_TABLE_BITS = 7;
+
+constexpr int MAX_CODE_LENGTH = 15;
+constexpr size_t MAX_MATCH = 258;
+constexpr size_t WINDOW_SIZE = 1 << 15;
+constexpr size_t BUFFER_SIZE = WINDOW_SIZE * 4;
+constexpr size_t COPY_SLACK = 16;  // matches are copied 8 bytes at a time and may overshoot
+
+constexpr uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+constexpr uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+constexpr uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+constexpr uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+constexpr uint8_t CODELEN_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static uint32_t litlen_entry(int symbol) {
+	if(symbol < 256) {
+		return make_entry(ENTRY_LITERAL, 0, 0, symbol);
+	}
+	if(symbol == 256) {
+		return make_entry(ENTRY_END, 0, 0, 0);
+	}
+	if(symbol < 286) {
+		return make_entry(ENTRY_LENGTH, 0, LENGTH_EXTRA[symbol - 257], LENGTH_BASE[symbol - 257]);
+	}
+	return ENTRY_INVALID;
+}
+
+static uint32_t distance_entry(int symbol) {
+	return symbol < 30 ? make_entry(ENTRY_DISTANCE, 0, DISTANCE_EXTRA[symbol], DISTANCE_BASE[symbol]) : ENTRY_INVALID;
+}
+
+static uint32_t codelen_entry(int symbol) {
+	return make_entry(ENTRY_LITERAL, 0, 0, symbol);
+}
+
+static uint32_t reverse_bits(uint32_t code, int length) {
+	uint32_t reversed = 0;
+	for (int i = 0; i < length; ++i) {
+		reversed = (reversed << 1) | (code & 1);
+		code >>= 1;
+	}
+	return reversed;
+}
+
+// Canonical Huffman lookup table indexed by the next table_bits of input (deflate sends codes bit reversed)
+// codes longer than that continue in subtables appended after the main table, unused codes stay ENTRY_INVALID
+// returns false when the lengths over-subscribe the code space
+static bool build_table(const uint8_t* lengths, int count, int table_bits, uint32_t (*symbol_entry)(int), std::vector<uint32_t>& table) {
+	int length_count[MAX_CODE_LENGTH + 1] = { 0 };
+	for (int symbol = 0; symbol < count; ++symbol) {
+		++length_count[lengths[symbol]];
+	}
+	length_count[0] = 0;
+
+	int left = 1;
+	for (int length = 1; length <= MAX_CODE_LENGTH; ++length) {
+		left = (left << 1) - length_count[length];
+		if(left < 0) {
+			return false;
+		}
+	}
+
+	uint32_t next_code[MAX_CODE_LENGTH + 1] = { 0 };
+	uint32_t code = 0;
+	for (int length = 1; length <= MAX_CODE_LENGTH; ++length) {
+		code = (code + length_count[length - 1]) << 1;
+		next_code[length] = code;
+	}
+
+	const uint32_t main_size = 1u << table_bits;
+	const uint32_t main_mask = main_size - 1;
+
+	uint32_t codes[288];
+	uint8_t subtable_bits[1 << LITLEN_TABLE_BITS] = { 0 };
+
+	for (int symbol = 0; symbol < count; ++symbol) {
+		const int length = lengths[symbol];
+		if(length == 0) {
+			continue;
+		}
+		codes[symbol] = reverse_bits(next_code[length]++, length);
+
+		if(length > table_bits) {
+			uint8_t& bits = subtable_bits[codes[symbol] & main_mask];
+			bits = std::max(bits, uint8_t(length - table_bits));
+		}
+	}
+
+	table.assign(main_size, ENTRY_INVALID);
+
+	for (uint32_t prefix = 0; prefix < main_size; ++prefix) {
+		if(subtable_bits[prefix]) {
+			table[prefix] = make_entry(ENTRY_SUBTABLE, table_bits, subtable_bits[prefix], uint32_t(table.size()));
+			table.resize(table.size() + (size_t(1) << subtable_bits[prefix]), ENTRY_INVALID);
+		}
+	}
+
+	for (int symbol = 0; symbol < count; ++symbol) {
+		const uint32_t length = lengths[symbol];
+		if(length == 0) {
+			continue;
+		}
+		const uint32_t entry = symbol_entry(symbol);
+
+		if(length <= uint32_t(table_bits)) {
+			for (uint32_t index = codes[symbol]; index < main_size; index += 1u << length) {
+				table[index] = entry | length;
+			}
+		}
+		else {
+			const uint32_t subtable = table[codes[symbol] & main_mask];
+			const uint32_t offset = entry_value(subtable);
+			const uint32_t size = 1u << entry_extra(subtable);
+			const uint32_t sub_length = length - table_bits;
+
+			for (uint32_t index = codes[symbol] >> table_bits; index < size; index += 1u << sub_length) {
+				table[offset + index] = entry | sub_length;
+			}
+		}
+	}
+
+	return true;
+}
+
+// Where two literal codes fit in one lookup together, the entry decodes both
+// walked from the top so every entry read is still the single symbol one
+static void pair_literals(std::vector<uint32_t>& table, int table_bits) {
+	for (int index = (1 << table_bits) - 1; index >= 0; --index) {
+		const uint32_t first = table[index];
+		if(entry_kind(first) != ENTRY_LITERAL) {
+			continue;
+		}
+
+		const uint32_t first_length = entry_length(first);
+		const uint32_t second = table[index >> first_length];
+
+		if(entry_kind(second) == ENTRY_LITERAL && first_length + entry_length(second) <= uint32_t(table_bits)) {
+			table[index] = make_entry(ENTRY_LITERAL_PAIR, first_length + entry_length(second), 0, entry_value(first) | entry_value(second) << 8);
+		}
+	}
+}
+
+// Copies a match that may overlap its own output
+static inline void copy_match(uint8_t* out, size_t distance, size_t length) {
+	const uint8_t* from = out - distance;
+
+	if(distance >= 8) { // a word never reads bytes it writes, the last one may run into the slack
+		uint8_t* const end = out + length;
+		do {
+			uint64_t word;
+			memcpy(&word, from, 8);
+			memcpy(out, &word, 8);
+			from += 8;
+			out += 8;
+		} while (out < end);
+	}
+	else if(distance == 1) {
+		memset(out, *from, length);
+	}
+	else {
+		for (size_t i = 0; i < length; ++i) {
+			out[i] = from[i];
+		}
+	}
+}
+
+// Table driven inflate with a 64 bit bit buffer, refilled with one unaligned load per symbol
+// input is read in place, so everything has to be fed (and kept alive) before the first read
+// output goes through a window that slides once it fills, reads can ask for any amount at a time
+class FastInflater : public Inflater {
+public:
+	FastInflater() :
+		_next_input		( 0 ),
+		_in				( nullptr ),
+		_in_end			( nullptr ),
+		_bits			( 0 ),
+		_bit_count		( 0 ),
+		_padding		( 0 ),
+		_finished		( false ),
+		_state			( State::Header ),
+		_final_block	( false ),
+		_stored_remaining ( 0 ),
+		_litlen			( nullptr ),
+		_distance		( nullptr ),
+		_window			( BUFFER_SIZE + COPY_SLACK ),
+		_read_pos		( 0 ),
+		_write_pos		( 0 ),
+		_adler			( 1 ),
+		_verify_adler	( verify_adler32() )
+	{}
+
+	bool streaming() const {
+		return false;
+	}
+
+	void feed(const char* data, size_t size) {
+		if(size > 0) {
+			_inputs.push_back({ (const uint8_t*)data, size });
+		}
+	}
+
+	void finish() {
+		_finished = true;
+	}
+
+	size_t read(char* out, size_t size) {
+		size_t written = 0;
+
+		while (true) {
+			const size_t count = std::min(size - written, _write_pos - _read_pos);
+			memcpy(out + written, &_window[_read_pos], count);
+			_read_pos += count;
+			written += count;
+
+			if(written == size || !_finished || _state == State::End || _state == State::Error) {
+				break;
+			}
+
+			if(_write_pos > BUFFER_SIZE - MAX_MATCH) {
+				slide();
+			}
+			decode();
+		}
+
+		return written;
+	}
+
+	bool ended() const {
+		return _state == State::End;
+	}
+
+	bool failed() const {
+		return _state == State::Error;
+	}
+private:
+	enum class State { Header, BlockHeader, Stored, Huffman, Trailer, End, Error };
+
+	struct Input {
+		const uint8_t* _data;
+		size_t _size;
+	};
+
+	void decode();
+	void decode_huffman();
+	void copy_stored();
+	bool read_block_header();
+	bool read_dynamic_tables();
+	bool read_trailer();
+
+	void slide();
+	void refill();
+	void refill_slow();
+	uint32_t take_bits(int count);
+	bool overrun() const;
+	void fail();
+
+	std::vector<Input> _inputs;
+	size_t _next_input;
+
+	const uint8_t* _in;
+	const uint8_t* _in_end;
+	uint64_t _bits;
+	int _bit_count;
+	int _padding;  // zero bytes appended past the end of the input so a refill always has 56 bits
+	bool _finished;
+
+	State _state;
+	bool _final_block;
+	size_t _stored_remaining;
+
+	const uint32_t* _litlen;
+	const uint32_t* _distance;
+	std::vector<uint32_t> _litlen_table;
+	std::vector<uint32_t> _distance_table;
+	std::vector<uint32_t> _codelen_table;
+	std::vector<uint32_t> _fixed_litlen_table;
+	std::vector<uint32_t> _fixed_distance_table;
+
+	std::vector<uint8_t> _window;  // at least WINDOW_SIZE of history before _read_pos, unread output after it
+	size_t _read_pos;
+	size_t _write_pos;
+
+	uint32_t _adler;
+	bool _verify_adler;  // off, the trailer is still read but not compared
+};
+
+void FastInflater::decode() {
+	const size_t start = _write_pos;
+
+	while (_write_pos <= BUFFER_SIZE - MAX_MATCH) {
+		if(_state == State::Header) {
+			const uint32_t cmf = take_bits(8);
+			const uint32_t flg = take_bits(8);
+
+			if((cmf & 0x0f) != 8 || (cmf >> 4) > 7 || (cmf << 8 | flg) % 31 != 0 || (flg & 0x20) || overrun()) { // deflate, 32K window at most, no preset dictionary
+				fail();
+			}
+			else {
+				_state = State::BlockHeader;
+			}
+		}
+		else if(_state == State::BlockHeader) {
+			if(!read_block_header()) {
+				fail();
+			}
+		}
+		else if(_state == State::Stored) {
+			copy_stored();
+		}
+		else if(_state == State::Huffman) {
+			decode_huffman();
+		}
+		else if(_state == State::Trailer) {
+			if(_verify_adler) {
+				_adler = update_adler32(_adler, (const char*)&_window[start], _write_pos - start);
+			}
+
+			if(!read_trailer()) {
+				fail();
+			}
+			return;
+		}
+		else {
+			break;
+		}
+	}
+
+	if(_state != State::Error && _verify_adler) {
+		_adler = update_adler32(_adler, (const char*)&_window[start], _write_pos - start);
+	}
+}
+
+void FastInflater::decode_huffman() {
+	// locals so the compiler keeps them in registers, stores to the window could alias members
+	uint64_t bits = _bits;
+	int bit_count = _bit_count;
+	int padding_bits = _padding * 8;
+	const uint8_t* in = _in;
+	const uint8_t* in_end = _in_end;
+
+	uint8_t* const window = _window.data();
+	size_t out = _write_pos;
+
+	const uint32_t* const litlen = _litlen;
+	const uint32_t* const distances = _distance;
+
+	constexpr uint64_t litlen_mask = (1 << LITLEN_TABLE_BITS) - 1;
+	constexpr uint64_t distance_mask = (1 << DISTANCE_TABLE_BITS) - 1;
+
+	bool error = false;
+
+	while (out <= BUFFER_SIZE - MAX_MATCH) {
+		// 56 bits covers the longest length code, its extra bits, distance code and extra bits (15 + 5 + 15 + 13)
+		if(in_end - in >= 8) {
+			uint64_t word;
+			memcpy(&word, in, 8);  // little endian
+			bits |= word << bit_count;
+			in += (63 - bit_count) >> 3;
+			bit_count |= 56;
+		}
+		else {
+			_bits = bits;
+			_bit_count = bit_count;
+			_in = in;
+			refill_slow();
+			bits = _bits;
+			bit_count = _bit_count;
+			padding_bits = _padding * 8;
+			in = _in;
+			in_end = _in_end;
+
+			if(_state == State::Error) {
+				return;
+			}
+		}
+
+		uint32_t entry = litlen[bits & litlen_mask];
+		if(entry_kind(entry) == ENTRY_SUBTABLE) {
+			bits >>= LITLEN_TABLE_BITS;
+			bit_count -= LITLEN_TABLE_BITS;
+			entry = litlen[entry_value(entry) + (bits & ((1u << entry_extra(entry)) - 1))];
+		}
+
+		bits >>= entry_length(entry);
+		bit_count -= entry_length(entry);
+
+		const uint32_t kind = entry_kind(entry);
+
+		if(kind == ENTRY_LITERAL_PAIR) {
+			window[out] = uint8_t(entry_value(entry));
+			window[out + 1] = uint8_t(entry_value(entry) >> 8);
+			out += 2;
+		}
+		else if(kind == ENTRY_LITERAL) {
+			window[out++] = uint8_t(entry_value(entry));
+		}
+		else if(kind == ENTRY_LENGTH) {
+			const size_t length = entry_value(entry) + (bits & ((1u << entry_extra(entry)) - 1));
+			bits >>= entry_extra(entry);
+			bit_count -= entry_extra(entry);
+
+			uint32_t distance_code = distances[bits & distance_mask];
+			if(entry_kind(distance_code) == ENTRY_SUBTABLE) {
+				bits >>= DISTANCE_TABLE_BITS;
+				bit_count -= DISTANCE_TABLE_BITS;
+				distance_code = distances[entry_value(distance_code) + (bits & ((1u << entry_extra(distance_code)) - 1))];
+			}
+
+			bits >>= entry_length(distance_code);
+			bit_count -= entry_length(distance_code);
+
+			const size_t distance = entry_value(distance_code) + (bits & ((1u << entry_extra(distance_code)) - 1));
+			bits >>= entry_extra(distance_code);
+			bit_count -= entry_extra(distance_code);
+
+			if(entry_kind(distance_code) != ENTRY_DISTANCE || distance > out) { // bad code or reaching back before the start of the stream
+				error = true;
+				break;
+			}
+
+			copy_match(window + out, distance, length);
+			out += length;
+		}
+		else if(kind == ENTRY_END) {
+			_state = _final_block ? State::Trailer : State::BlockHeader;
+			break;
+		}
+		else {
+			error = true;
+			break;
+		}
+
+		if(bit_count < padding_bits) { // decoded from past the end of the input
+			error = true;
+			break;
+		}
+	}
+
+	_bits = bits;
+	_bit_count = bit_count;
+	_in = in;
+	_write_pos = out;
+
+	if(error || overrun()) {
+		fail();
+	}
+}
+
+void FastInflater::copy_stored() {
+	while (_stored_remaining > 0 && _write_pos < BUFFER_SIZE) {
+		if(_bit_count >= 8) { // whole bytes already in the bit buffer come first
+			_window[_write_pos++] = uint8_t(_bits);
+			_bits >>= 8;
+			_bit_count -= 8;
+			--_stored_remaining;
+
+			if(overrun()) {
+				fail();
+				return;
+			}
+			continue;
+		}
+
+		_bits = 0;
+
+		if(_in == _in_end) {
+			if(_next_input == _inputs.size()) {
+				fail();
+				return;
+			}
+			_in = _inputs[_next_input]._data;
+			_in_end = _in + _inputs[_next_input]._size;
+			++_next_input;
+		}
+
+		const size_t count = std::min({ _stored_remaining, size_t(_in_end - _in), BUFFER_SIZE - _write_pos });
+		memcpy(&_window[_write_pos], _in, count);
+
+		_in += count;
+		_write_pos += count;
+		_stored_remaining -= count;
+	}
+
+	if(_stored_remaining == 0) {
+		_state = _final_block ? State::Trailer : State::BlockHeader;
+	}
+}
+
+bool FastInflater::read_block_header() {
+	_final_block = take_bits(1);
+	const uint32_t type = take_bits(2);
+
+	if(type == 0) { // stored
+		take_bits(_bit_count & 7);
+
+		const uint32_t length = take_bits(16);
+		const uint32_t inverse = take_bits(16);
+
+		if(length != (~inverse & 0xffff)) {
+			return false;
+		}
+
+		_stored_remaining = length;
+		_state = State::Stored;
+	}
+	else if(type == 1) { // fixed codes
+		if(_fixed_litlen_table.empty()) {
+			uint8_t lengths[288 + 32];
+			memset(lengths, 8, 144);
+			memset(lengths + 144, 9, 112);
+			memset(lengths + 256, 7, 24);
+			memset(lengths + 280, 8, 8);
+			memset(lengths + 288, 5, 32);
+
+			build_table(lengths, 288, LITLEN_TABLE_BITS, litlen_entry, _fixed_litlen_table);
+			build_table(lengths + 288, 32, DISTANCE_TABLE_BITS, distance_entry, _fixed_distance_table);
+			pair_literals(_fixed_litlen_table, LITLEN_TABLE_BITS);
+		}
+
+		_litlen = _fixed_litlen_table.data();
+		_distance = _fixed_distance_table.data();
+		_state = State::Huffman;
+	}
+	else if(type == 2) { // dynamic codes
+		if(!read_dynamic_tables()) {
+			return false;
+		}
+
+		_litlen = _litlen_table.data();
+		_distance = _distance_table.data();
+		_state = State::Huffman;
+	}
+	else {
+		return false;
+	}
+
+	return !overrun();
+}
+
+bool FastInflater::read_dynamic_tables() {
+	const int litlen_count = take_bits(5) + 257;
+	const int distance_count = take_bits(5) + 1;
+	const int codelen_count = take_bits(4) + 4;
+
+	if(litlen_count > 286 || distance_count > 30) {
+		return false;
+	}
+
+	uint8_t codelen_lengths[19] = { 0 };
+	for (int i = 0; i < codelen_count; ++i) {
+		codelen_lengths[CODELEN_ORDER[i]] = uint8_t(take_bits(3));
+	}
+
+	if(!build_table(codelen_lengths, 19, CODELEN_TABLE_BITS, codelen_entry, _codelen_table)) {
+		return false;
+	}
+
+	uint8_t lengths[286 + 30] = { 0 };
+	const int total = litlen_count + distance_count;
+
+	for (int i = 0; i < total;) {
+		if(_bit_count < 16) {
+			refill();
+		}
+
+		const uint32_t entry = _codelen_table[_bits & ((1 << CODELEN_TABLE_BITS) - 1)];
+		if(entry_kind(entry) == ENTRY_INVALID || overrun()) {
+			return false;
+		}
+		_bits >>= entry_length(entry);
+		_bit_count -= entry_length(entry);
+
+		const uint32_t symbol = entry_value(entry);
+
+		if(symbol < 16) {
+			lengths[i++] = uint8_t(symbol);
+			continue;
+		}
+
+		uint8_t value = 0;
+		int repeat = 0;
+
+		if(symbol == 16) { // repeat the previous length
+			if(i == 0) {
+				return false;
+			}
+			value = lengths[i - 1];
+			repeat = 3 + take_bits(2);
+		}
+		else if(symbol == 17) {
+			repeat = 3 + take_bits(3);
+		}
+		else {
+			repeat = 11 + take_bits(7);
+		}
+
+		if(i + repeat > total) {
+			return false;
+		}
+
+		memset(&lengths[i], value, repeat);
+		i += repeat;
+	}
+
+	if(lengths[256] == 0) { // no end of block code
+		return false;
+	}
+
+	if(!build_table(lengths, litlen_count, LITLEN_TABLE_BITS, litlen_entry, _litlen_table) ||
+	   !build_table(lengths + litlen_count, distance_count, DISTANCE_TABLE_BITS, distance_entry, _distance_table)) {
+		return false;
+	}
+
+	pair_literals(_litlen_table, LITLEN_TABLE_BITS);
+
+	return !overrun();
+}
+
+bool FastInflater::read_trailer() {
+	take_bits(_bit_count & 7);
+
+	uint32_t adler = 0;
+	for (int i = 0; i < 4; ++i) {
+		adler = (adler << 8) | take_bits(8);
+	}
+
+	if(overrun() || (_verify_adler && adler != _adler)) {
+		return false;
+	}
+
+	_state = State::End;
+
+	return true;
+}
+
+void FastInflater::slide() {
+	const size_t keep_from = std::min(_read_pos, _write_pos - WINDOW_SIZE);
+
+	memmove(&_window[0], &_window[keep_from], _write_pos - keep_from);
+
+	_read_pos -= keep_from;
+	_write_pos -= keep_from;
+}
+
+void FastInflater::refill() {
+	if(_in_end - _in >= 8) {
+		uint64_t word;
+		memcpy(&word, _in, 8);
+		_bits |= word << _bit_count;
+		_in += (63 - _bit_count) >> 3;
+		_bit_count |= 56;
+	}
+	else {
+		refill_slow();
+	}
+}
+
+// Byte at a time across the ends of the fed pieces, pads with zeros past the last one
+void FastInflater::refill_slow() {
+	_bits &= (uint64_t(1) << _bit_count) - 1; // fast refills leave a copy of upcoming bytes above the count
+
+	while (_bit_count < 56) {
+		if(_in == _in_end) {
+			if(_next_input < _inputs.size()) {
+				_in = _inputs[_next_input]._data;
+				_in_end = _in + _inputs[_next_input]._size;
+				++_next_input;
+				continue;
+			}
+
+			++_padding;
+			_bit_count += 8;
+			continue;
+		}
+
+		_bits |= uint64_t(*_in++) << _bit_count;
+		_bit_count += 8;
+	}
+
+	if(_padding > 16) { // already past the end, a corrupt stream would otherwise run on zeros
+		fail();
+	}
+}
+
+uint32_t FastInflater::take_bits(int count) {
+	if(_bit_count < count) {
+		refill();
+	}
+
+	const uint32_t value = uint32_t(_bits & ((uint64_t(1) << count) - 1));
+	_bits >>= count;
+	_bit_count -= count;
+
+	return value;
+}
+
+bool FastInflater::overrun() const {
+	return _bit_count < _padding * 8;
+}
+
+void FastInflater::fail() {
+	_state = State::Error;
+}
+
+// *********************************************************************************************************************************************************************************************************************
+
+std::unique_ptr<Inflater> make_inflater(InflateBackend backend) {
+	if(backend == InflateBackend::Fast) {
+		return std::make_unique<FastInflater>();
+	}
+	return std::make_unique<ZlibInflater>();
+}
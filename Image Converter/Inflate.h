@@ -0,0 +1,46 @@
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include <memory>
+#include <cstddef>
+
+// Inflate implementations the decoders can use
+// Zlib is the vendored library, Fast is the table driven decoder in Inflate.cpp
+enum class InflateBackend { Zlib, Fast };
+
+// Build default, define INFLATE_DEFAULT_ZLIB to start with zlib instead
+#ifdef INFLATE_DEFAULT_ZLIB
+#define INFLATE_DEFAULT_BACKEND InflateBackend::Zlib
+#else
+#define INFLATE_DEFAULT_BACKEND InflateBackend::Fast
+#endif
+
+// Decompresses one zlib stream (header, deflate data, adler32 trailer)
+class Inflater {
+public:
+	virtual ~Inflater() = default;
+
+	// Streaming inflaters are done with the input given to feed as soon as read stops asking for more
+	// the others keep pointers into it until the stream ends, so all of it has to stay alive and be fed before reading
+	virtual bool streaming() const = 0;
+
+	virtual void feed(const char* data, size_t size) = 0;
+	virtual void finish() {}  // no more input is coming
+
+	// Writes up to size bytes to out, returns how many were written
+	// less than size means more input is needed, the stream ended or it's corrupt
+	virtual size_t read(char* out, size_t size) = 0;
+
+	virtual bool ended() const = 0;
+	virtual bool failed() const = 0;
+};
+
+std::unique_ptr<Inflater> make_inflater(InflateBackend backend);
+
+// Backend new decoders pick up, for the stream decoder a non-streaming choice falls back to zlib
+void set_inflate_backend(InflateBackend backend);
+InflateBackend inflate_backend();
+
+const char* inflate_backend_name(InflateBackend backend);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+// One per core, at least one
+inline int hardware_threads() {
+	return std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+// Runs work(index) for every index below count on up to threads threads, the calling thread included
+// indices are handed out in increasing order
+template<typename Work>
+void run_parallel(int threads, int count, Work work) {
+	std::atomic<int> next { 0 };
+
+	auto worker = [&]() {
+		for (int index; (index = next.fetch_add(1)) < count;) {
+			work(index);
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (int i = 1; i < std::min(threads, count); ++i) {
+		pool.emplace_back(worker);
+	}
+
+	worker();
+
+	for (auto& thread : pool) {
+		thread.join();
+	}
+}
+
+#endif
@@ -0,0 +1,70 @@
+#include "Progress.h"
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+static ProgressCallback progress_callback;
+static std::atomic<bool> progress_listening{ false };
+static int progress_every_rows = 0;
+static int progress_every_ms = 0;
+
+static int64_t now_ms() {
+	using namespace std::chrono;
+	return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void set_progress_callback(ProgressCallback callback, int every_rows, int every_ms) {
+	progress_listening = false;
+
+	progress_callback = std::move(callback);
+	progress_every_rows = every_rows;
+	progress_every_ms = every_ms;
+
+	progress_listening = bool(progress_callback);
+}
+
+bool progress_enabled() {
+	return progress_listening.load(std::memory_order_relaxed);
+}
+
+void print_progress(std::string_view process, int done, int total) {
+	std::cout << std::setw(30) << std::left << process << " (" << (float(done) / float(total)) * 100.0f << "%) \n";
+}
+
+void report_progress(std::string_view process, int done, int total) {
+	if(progress_enabled()) {
+		progress_callback(process, done, total);
+	}
+}
+
+ProgressThrottle::ProgressThrottle(std::string_view process, int total) :
+	_process	( process ),
+	_total		( total ),
+	_next_done	( 0 ),
+	_next_time	( 0 ),
+	_enabled	( progress_enabled() )
+{}
+
+void ProgressThrottle::report(int done) {
+	const bool last = done + 1 >= _total;
+
+	if(!last) {
+		if(done < _next_done) {
+			return;
+		}
+
+		if(progress_every_ms > 0) {
+			const int64_t now = now_ms();
+			if(now < _next_time) {
+				return;
+			}
+			_next_time = now + progress_every_ms;
+		}
+	}
+
+	_next_done = done + (progress_every_rows > 0 ? progress_every_rows : 1);
+
+	progress_callback(_process, done, _total);
+}
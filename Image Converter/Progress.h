@@ -0,0 +1,42 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+// Called with the name of the step and how far along it is, may be called from several threads at once
+using ProgressCallback = std::function<void(std::string_view process, int done, int total)>;
+
+// Installs a listener (nullptr removes it), install before converting rather than during
+// per row loops report every `every_rows` rows and at most once every `every_ms`, 0 leaves that limit off
+void set_progress_callback(ProgressCallback callback, int every_rows = 0, int every_ms = 0);
+bool progress_enabled();
+
+// The console format print_status used to write, usable as a callback
+void print_progress(std::string_view process, int done, int total);
+
+// Reports one step, nothing is formatted or written when nobody is listening
+void report_progress(std::string_view process, int done, int total);
+
+// Rate limited reporting for loops that run once per row
+class ProgressThrottle {
+public:
+	ProgressThrottle(std::string_view process, int total);
+
+	void update(int done) {
+		if(_enabled) {
+			report(done);
+		}
+	}
+private:
+	void report(int done);
+
+	std::string_view _process;
+	int _total;
+	int _next_done;
+	int64_t _next_time;
+	bool _enabled;
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "ThreadPool.h"
+#include "Parallel.h"
+
+// Which pool and queue the current thread works for, so tasks submitted from a task stay local
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local int current_index = -1;
+
+ThreadPool::ThreadPool(int threads) :
+	_queued  ( 0 ),
+	_pending ( 0 ),
+	_next    ( 0 ),
+	_stop    ( false ) {
+	if(threads <= 0) {
+		threads = hardware_threads();
+	}
+
+	for (int i = 0; i < threads; ++i) {
+		_queues.push_back(std::make_unique<Queue>());
+	}
+
+	for (int i = 0; i < threads; ++i) {
+		_threads.emplace_back(&ThreadPool::work, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	wait();
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_wake.notify_all();
+
+	for (auto& thread : _threads) {
+		thread.join();
+	}
+}
+
+// ****************************************************************************************************
+
+void ThreadPool::submit(std::function<void()> task) {
+	size_t index;
+
+	if(current_pool == this) {
+		index = current_index;
+	}
+	else {
+		std::lock_guard<std::mutex> lock(_mutex);
+		index = _next++ % _queues.size();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_queues[index]->_mutex);
+		_queues[index]->_tasks.push_back(std::move(task));
+	}
+
+	// counted only once it is in a queue, a worker that claims it is then sure to find it
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		++_queued;
+		++_pending;
+	}
+	_wake.notify_one();
+}
+
+void ThreadPool::wait() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	_idle.wait(lock, [this] { return _pending == 0; });
+}
+
+int ThreadPool::size() const {
+	return int(_threads.size());
+}
+
+// ****************************************************************************************************
+
+// Own queue first, then the others starting from the next one over
+bool ThreadPool::take(int index, std::function<void()>& task) {
+	const int count = int(_queues.size());
+
+	for (int i = 0; i < count; ++i) {
+		Queue& queue = *_queues[(index + i) % count];
+
+		std::lock_guard<std::mutex> lock(queue._mutex);
+		if(!queue._tasks.empty()) {
+			task = std::move(queue._tasks.front());
+			queue._tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::work(int index) {
+	current_pool = this;
+	current_index = index;
+
+	std::function<void()> task;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this] { return _queued > 0 || _stop; });
+
+			if(_queued == 0) {
+				return;
+			}
+
+			--_queued;
+		}
+
+		// the claim above guarantees one task is left for this worker somewhere
+		while(!take(index, task));
+
+		task();
+		task = nullptr;
+
+		bool idle;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			idle = --_pending == 0;
+		}
+
+		if(idle) {
+			_idle.notify_all();
+		}
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+// Fixed set of workers with a task queue each, a worker that runs dry steals from the others
+// tasks are taken from the front on both sides, so they start roughly in the order they were submitted
+class ThreadPool {
+public:
+	explicit ThreadPool(int threads = 0);  // 0 is one per core
+	~ThreadPool();                         // finishes what was submitted first
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// From outside the pool tasks are dealt round robin, from inside a task they go to that worker's own queue
+	void submit(std::function<void()> task);
+
+	// Blocks until every submitted task has run
+	void wait();
+
+	int size() const;
+private:
+	struct Queue {
+		std::mutex _mutex;
+		std::deque<std::function<void()>> _tasks;
+	};
+
+	void work(int index);
+	bool take(int index, std::function<void()>& task);
+
+	std::vector<std::unique_ptr<Queue>> _queues;
+	std::vector<std::thread> _threads;
+
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _idle;
+	size_t _queued;   // sitting in a queue and not yet claimed by a worker
+	size_t _pending;  // submitted and not yet finished
+	size_t _next;
+	bool _stop;
+};
+
+#endif
@@ -1,19 +1,94 @@
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
 
 #include "Image.h"
+#include "Batch.h"
+#include "Progress.h"
 
-int main() {
+// usage: Image Converter [--effort 0-9] [--threads N] [--out DIR] [--probe] [inputs...]
+// PNGs are converted to BMP and BMPs to PNG, effort trades PNG encode speed for size, without inputs test.png is converted to new.bmp
+// inputs are files, directories, globs or @list files and convert as a batch on --threads threads (one per core by default),
+// next to each input or below --out
+// --probe only prints what the header of the first input says
+int main(int argc, char** argv) {
+	const char* file = "test.png";
+	int effort = DEFAULT_EFFORT;
+	bool probe = false;
 
-	ImageReader image_reader("test.png");
+	BatchOptions batch;
+	std::vector<std::string> inputs;
+
+	for (int i = 1; i < argc; ++i) {
+		if(strcmp(argv[i], "--effort") == 0 && i + 1 < argc) {
+			effort = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			batch._threads = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+			batch._out = argv[++i];
+		}
+		else if(strcmp(argv[i], "--probe") == 0) {
+			probe = true;
+		}
+		else {
+			inputs.push_back(argv[i]);
+		}
+	}
+
+	if(!inputs.empty()) {
+		file = inputs[0].c_str();
+	}
+
+	if(probe) {
+		ImageInfo info;
+		if(!probe_image(file, info)) {
+			std::cout << "Cannot read image header -- " << file << '\n';
+			return 1;
+		}
+
+		print_info(info);
+		return 0;
+	}
+
+	if(!inputs.empty()) {
+		std::vector<BatchJob> jobs;
+		const bool ok = collect_batch_jobs(inputs, batch._out, jobs);
+
+		batch._encode = effort_options(effort);
+
+		const BatchResult result = run_batch(jobs, batch);
+		print_batch_result(result);
+
+		return ok && result._failed == 0 ? 0 : 1;
+	}
+
+	set_progress_callback(print_progress, 0, 100);
+
+	ImageReader image_reader(file);
+
+	auto image = image_reader.release();
+	if(!image) {
+		return 1;
+	}
 
-	auto image = image_reader.image();
 	image->print_info();
 
-	auto bmp = image->to_bmp();
-	bmp.print_info();
-	bmp.save("new");
+	if(image->get_type() == TYPE_BMP) {
+		auto png = std::move(*image).to_png();
+		png.print_info();
+		png.save("new", effort_options(effort));
+	}
+	else {
+		auto bmp = std::move(*image).to_bmp();
+		bmp.print_info();
+		bmp.save("new");
+	}
 
 	system("PAUSE");
 
 	return 0;
-}
\ No newline at end of file
+}